@@ -5,23 +5,24 @@
 #include "utils/safer.h"
 #include "events.h"
 
-void free_event(struct event *e)
+void free_event(struct event_pool *pool, struct event *e)
 {
     for (size_t i = 0; i < e->alloc_len; ++i)
         free_safer(e->alloc[i]);
-    free(e->self);
+    event_pool_put(pool, e->self);
 }
 
 static bool event_node_data_cb(struct event_args args)
 {
-    return node_handle_data(args.node_data.kctx);
+    return node_handle_data(args.node_data.kctx, args.node_data.recv);
 }
 struct event event_node_data = {"node-data", .cb=event_node_data_cb, .args={{{0}}}, .fatal=false,};
 
 static bool event_peer_conn_cb(struct event_args args)
 {
     if (peer_conn_accept_all(args.peer_conn.sock, args.peer_conn.peers,
-                             args.peer_conn.nfds, args.peer_conn.conf) < 0) {
+                             args.peer_conn.poller, args.peer_conn.kctx,
+                             args.peer_conn.conf) < 0) {
         log_error("Could not accept tcp connection.");
         return false;
     }
@@ -29,21 +30,14 @@ static bool event_peer_conn_cb(struct event_args args)
 }
 struct event event_peer_conn = {"peer-conn", .cb=event_peer_conn_cb, .args={{{0}}}, .fatal=true,};
 
-bool event_kad_response_cb(struct event_args args)
-{
-    return kad_response(args.kad_response.sock, args.kad_response.buf, args.kad_response.addr);
-}
-
 bool event_peer_data_cb(struct event_args args)
 {
-    struct peer *p = peer_find_by_fd(args.peer_data.peers, args.peer_data.fd);
-    if (!p) {
-        log_fatal("Unregistered peer fd=%d.", args.peer_data.fd);
-        return false;
-    }
+    struct peer *p = args.peer_data.peer;
+    int fd = p->fd;
+    // Frees @p, which embeds this event.
     if (peer_conn_handle_data(p, args.peer_data.kctx) == CONN_CLOSED &&
-        !peer_conn_close(p)) {
-        log_fatal("Could not close connection of peer fd=%d.", args.peer_data.fd);
+        !peer_conn_close(p, args.peer_data.poller)) {
+        log_fatal("Could not close connection of peer fd=%d.", fd);
         return false;
     }
     return true;
@@ -70,15 +64,23 @@ bool event_kad_ping_cb(struct event_args args)
 bool event_kad_find_node_cb(struct event_args args)
 {
     return kad_find_node(args.kad_find_node.kctx, args.kad_find_node.node,
-                         args.kad_find_node.target);
+                         args.kad_find_node.target,
+                         args.kad_find_node.lookup_id);
+}
+
+bool event_kad_query_timeout_cb(struct event_args args)
+{
+    return kad_query_timeout(args.kad_query_timeout.kctx,
+                             args.kad_query_timeout.tx_id);
 }
 
 bool event_kad_lookup_cb(struct event_args args)
 {
-    return kad_lookup_timeout(args.kad_lookup.round, args.kad_lookup.kctx);
+    return kad_lookup_timeout(args.kad_lookup.id, args.kad_lookup.round,
+                              args.kad_lookup.kctx);
 }
 
 bool event_kad_lookup_next_cb(struct event_args args)
 {
-    return kad_lookup_next(args.kad_lookup_next.target, args.kad_lookup_next.kctx);
+    return kad_lookup_next(args.kad_lookup_next.id, args.kad_lookup_next.kctx);
 }
@@ -8,8 +8,8 @@
  * Events are created as sort of closures: a callback and its arguments. To
  * schedule them, we insert them into to the event queue either directly or via
  * timers, may it be with zero delay: an event is embedded into a timer, which
- * in turn is appended to the main timer list. The event loop consumes timers,
- * effectively removing them from the list, destroying them, freeing their
+ * in turn is inserted into the timer wheel. The event loop consumes timers,
+ * effectively removing them from the wheel, destroying them, freeing their
  * associated event and its associated allocations.
  *
  * In the future, we may want to distinguish emitted events from event
@@ -20,36 +20,39 @@
  */
 #include <netinet/in.h>
 #include "net/kad/routes.h"
+#include "utils/pool.h"
 #include "utils/queue.h"
 
 #define EVENT_NAME_MAX 32
+#define EVENT_ALLOC_MAX 4
+/* Enough for the per-query timeouts of a full req_lru. */
+#define EVENT_POOL_LEN 1280
 
+/* Bursts of timers (ex: catch-up) spill over the ring. */
 #define EVENT_QUEUE_BIT_LEN 8
-QUEUE_GENERATE(event_queue, struct event, EVENT_QUEUE_BIT_LEN)
+#define EVENT_QUEUE_SPILL_MAX 65536
+QUEUE_SPILL_GENERATE(event_queue, struct event, EVENT_QUEUE_BIT_LEN,
+                     EVENT_QUEUE_SPILL_MAX)
 
 struct event_args {
     union {
         struct node_data {
-            struct kad_ctx *kctx;
+            struct kad_ctx   *kctx;
+            struct node_recv *recv;
         } node_data;
 
-        struct kad_response {
-            int                      sock;
-            struct iobuf            *buf;
-            struct sockaddr_storage  addr;
-        } kad_response;
-
         struct peer_conn {
             int                  sock;
             struct list_item    *peers;
-            int                  nfds;
+            struct poller       *poller;
+            struct kad_ctx      *kctx;
             const struct config *conf;
         } peer_conn;
 
         struct peer_data {
-            struct list_item *peers;
+            struct peer      *peer;
+            struct poller    *poller;
             struct kad_ctx   *kctx;
-            int               fd;
         } peer_data;
 
         struct kad_refresh {
@@ -71,15 +74,22 @@ struct event_args {
             struct kad_ctx       *kctx;
             struct kad_node_info  node;
             kad_guid              target;
+            unsigned              lookup_id;
         } kad_find_node;
 
         struct {
+            kad_rpc_msg_tx_id  tx_id;
+            struct kad_ctx    *kctx;
+        } kad_query_timeout;
+
+        struct {
+            unsigned        id;
             int             round;
             struct kad_ctx *kctx;
         } kad_lookup;
 
         struct {
-            kad_guid        target;
+            unsigned        id;
             struct kad_ctx *kctx;
         } kad_lookup_next;
     };
@@ -97,20 +107,27 @@ struct event {
     struct event      *self;
     /* Used to free allocated associated data. Watch freeing order! */
     size_t             alloc_len;
-    void              *alloc[];
+    void              *alloc[EVENT_ALLOC_MAX];
 };
 
-void free_event(struct event *e);
+/**
+ * Allocated events are taken from the loop's pool with event_pool_get(), and
+ * given back after consumption with free_event().
+ */
+POOL_GENERATE(event_pool, struct event, EVENT_POOL_LEN)
+
+void free_event(struct event_pool *pool, struct event *e);
 
 extern struct event event_node_data;
 extern struct event event_peer_conn;
 extern struct event event_kad_refresh;
-// event to be malloc'd
-bool event_kad_response_cb(struct event_args args);
+// event embedded in each peer
 bool event_peer_data_cb(struct event_args args);
+// event to be malloc'd
 bool event_kad_bootstrap_cb(struct event_args args);
 bool event_kad_ping_cb(struct event_args args);
 bool event_kad_find_node_cb(struct event_args args);
+bool event_kad_query_timeout_cb(struct event_args args);
 bool event_kad_lookup_cb(struct event_args args);
 bool event_kad_lookup_next_cb(struct event_args args);
 
@@ -116,6 +116,11 @@ void log_perror(const int prio, const char *fmt, const int errnum)
     log_msg(prio, fmt, errtxt);
 }
 
+bool log_is_enabled(const int prio)
+{
+    return log_setmask && (LOG_MASK(prio) & log_setmask(0));
+}
+
 bool log_fmt_hex(char dst[], const size_t len, const unsigned char *id)
 {
     for (size_t i = 0; i < len; i++)
@@ -65,6 +65,12 @@ extern int (*log_setmask)(int);
  */
 void log_perror(const int prio, const char *fmt, const int errnum);
 
+/**
+ * Whether messages of @prio are logged. Use it to avoid formatting arguments
+ * of discarded messages.
+ */
+bool log_is_enabled(const int prio);
+
 /**
  * Hex formating.
  *
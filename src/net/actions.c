@@ -1,4 +1,6 @@
 /* Copyright (c) 2019 Foudil Brétel.  All rights reserved. */
+#define _GNU_SOURCE  // recvmmsg
+#include <sys/socket.h>
 #include <unistd.h>
 #include "config.h"
 #include "log.h"
@@ -7,6 +9,7 @@
 #include "net/socket.h"
 #include "timers.h"
 #include "utils/array.h"
+#include "utils/bits.h"
 #include "utils/helpers.h"
 #include "utils/safer.h"
 #include "utils/time.h"
@@ -17,99 +20,148 @@
 #define BOOTSTRAP_NODES_LEN 64
 // FIXME: low for testing purpose.
 #define SERVER_TCP_BUFLEN 10
-#define SERVER_UDP_BUFLEN 1400
-#define KAD_LOOKUP_TIMEOUT_MILLIS 250
 
 
-bool node_handle_data(struct kad_ctx *kctx)
+/**
+ * Queues a datagram for the next flush. When the queue is full, we try to
+ * make room by flushing right away.
+ */
+static bool kad_send(struct kad_ctx *kctx, const char buf[], size_t len,
+                     const struct sockaddr_storage *addr)
 {
-    bool ret = true;
+    if (dgram_queue_is_full(kctx->sendq) && !kctx->sendq->blocked)
+        dgram_queue_flush(kctx->sendq, kctx->sock);
+    if (!dgram_queue_put(kctx->sendq, buf, len, addr))
+        return false;
+    log_debug("Queued %zu bytes.", len);
+    return true;
+}
 
-    char buf[SERVER_UDP_BUFLEN];
-    memset(buf, 0, SERVER_UDP_BUFLEN);
-    struct sockaddr_storage node_addr;
-    socklen_t node_addr_len = sizeof(struct sockaddr_storage);
-    ssize_t slen = recvfrom(kctx->sock, buf, SERVER_UDP_BUFLEN, 0,
-                            (struct sockaddr *)&node_addr, &node_addr_len);
-    if (slen < 0) {
+/**
+ * Reads up to SERVER_UDP_BATCH_LEN datagrams into @nrecv.
+ *
+ * Returns the number of datagrams read, or -1 on error.
+ */
+static int node_recv_batch(int sock, struct node_recv *nrecv)
+{
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[SERVER_UDP_BATCH_LEN];
+    struct iovec iovecs[SERVER_UDP_BATCH_LEN];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < SERVER_UDP_BATCH_LEN; i++) {
+        iovecs[i].iov_base = nrecv->bufs[i];
+        iovecs[i].iov_len = SERVER_UDP_BUFLEN;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &nrecv->addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    int n = recvmmsg(sock, msgs, SERVER_UDP_BATCH_LEN, MSG_DONTWAIT, NULL);
+    if (n < 0) {
         if (errno != EWOULDBLOCK) {
-            log_perror(LOG_ERR, "Failed recv: %s", errno);
-            return false;
+            log_perror(LOG_ERR, "Failed recvmmsg: %s", errno);
+            return -1;
         }
-        return true;
+        return 0;
     }
-
-    char addr_str[INET6_ADDRSTRLEN+INET_PORTSTRLEN];
-    sockaddr_storage_fmt(addr_str, &node_addr);
-    log_debug("Received %d bytes from %s.", slen, addr_str);
-
-    struct iobuf *rsp = malloc(sizeof(struct iobuf));
-    if (!rsp) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
-        return false;
+    for (int i = 0; i < n; i++)
+        nrecv->lens[i] = msgs[i].msg_len;
+    return n;
+#else
+    int n = 0;
+    for (; n < SERVER_UDP_BATCH_LEN; n++) {
+        socklen_t addr_len = sizeof(struct sockaddr_storage);
+        ssize_t slen = recvfrom(sock, nrecv->bufs[n], SERVER_UDP_BUFLEN, 0,
+                                (struct sockaddr *)&nrecv->addrs[n], &addr_len);
+        if (slen < 0) {
+            if (errno != EWOULDBLOCK) {
+                log_perror(LOG_ERR, "Failed recv: %s", errno);
+                return -1;
+            }
+            break;
+        }
+        nrecv->lens[n] = slen;
     }
-    memset(rsp, 0, sizeof(struct iobuf));
+    return n;
+#endif
+}
 
-    bool resp = kad_rpc_handle(kctx, &node_addr, buf, (size_t)slen, rsp);
-    if (rsp->len == 0) {
-        log_info("Handling incoming message doesn't need further response.");
-        ret = resp; goto cleanup;
-    }
-    if (rsp->len > SERVER_UDP_BUFLEN) {
-        log_error("Response too large.");
-        ret = false; goto cleanup;
+static bool node_handle_datagram(struct kad_ctx *kctx, const char buf[],
+                                 size_t slen, struct sockaddr_storage node_addr)
+{
+    if (log_is_enabled(LOG_DEBUG)) {
+        ADDR_STR_DECL(addr_str);
+        sockaddr_storage_fmt(addr_str, &node_addr);
+        log_debug("Received %zu bytes from %s.", slen, addr_str);
     }
 
-    size_t nsub = 1;
-    struct event *evt = malloc(sizeof(struct event) + sizeof(void*[nsub]));
-    if (!evt) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
-        ret = false; goto cleanup;
-    }
-    *evt = (struct event){
-        "kad-response", .cb=event_kad_response_cb,
-        .args.kad_response={.sock=kctx->sock, .buf=rsp, .addr=node_addr},
-        .fatal=false, .self=evt, .alloc_len=nsub
-    };
-    evt->alloc[0] = rsp;
+    // Responses are encoded into a reusable buffer and queued right away, no
+    // need for a deferred event.
+    struct iobuf *rsp = &kctx->rspbuf;
+    iobuf_clear(rsp);
 
-    if (!set_timeout(kctx->timers, 0, true, evt)) {
-        ret = false; goto cleanup2;
+    bool resp = kad_rpc_handle(kctx, &node_addr, buf, slen, rsp);
+    if (rsp->len == 0) {
+        log_info("Handling incoming message doesn't need further response.");
+        return resp;
     }
 
-    return ret;
-
-  cleanup2:
-    free_safer(evt);
-  cleanup:
-    iobuf_reset(rsp);
-    free_safer(rsp);
-    return ret;
+    return kad_send(kctx, rsp->buf, rsp->len, &node_addr);
 }
 
-bool kad_response(int sock, struct iobuf *rsp, struct sockaddr_storage addr)
+/**
+ * Drains the UDP socket by batches. A failure to handle a datagram doesn't
+ * prevent handling the others.
+ */
+bool node_handle_data(struct kad_ctx *kctx, struct node_recv *nrecv)
 {
     bool ret = true;
 
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    ssize_t slen = sendto(sock, rsp->buf, rsp->len, 0,
-                          (struct sockaddr *)&addr, addr_len);
-    if (slen < 0) {
-        if (errno != EWOULDBLOCK) {
-            log_perror(LOG_ERR, "Failed sendto: %s", errno);
-            ret = false; goto cleanup;
-        }
-        goto cleanup;
+    int n = node_recv_batch(kctx->sock, nrecv);
+    if (n < 0)
+        return false;
+
+    nrecv->wakeups++;
+    nrecv->datagrams += n;
+    if ((size_t)n > nrecv->batch_max)
+        nrecv->batch_max = n;
+    log_debug("Received %d datagrams.", n);
+
+    for (int i = 0; i < n; i++) {
+        if (!node_handle_datagram(kctx, nrecv->bufs[i], nrecv->lens[i],
+                                  nrecv->addrs[i]))
+            ret = false;
     }
-    log_debug("Sent %d bytes.", slen);
 
-  cleanup:
-    iobuf_reset(rsp);
     return ret;
 }
 
+/**
+ * Flushes the UDP send queue. Writability of the UDP socket is only watched
+ * while the queue is blocked. The queue may get blocked outside of this, by
+ * kad_send() flushing a full queue, so the poller's state is tracked apart.
+ */
+bool node_flush_data(struct kad_ctx *kctx, struct poller *poller)
+{
+    struct dgram_queue *q = kctx->sendq;
+    dgram_queue_flush(q, kctx->sock);
+    if (q->blocked == q->out_armed)
+        return true;
+
+    unsigned events = POLLER_IN;
+    if (q->blocked)
+        BITS_SET(events, POLLER_OUT);
+    if (!poller_mod(poller, kctx->sock, events))
+        return false;
+    q->out_armed = q->blocked;
+    return true;
+}
+
 static struct peer*
-peer_register(struct list_item *peers, int conn, const struct sockaddr_storage *addr)
+peer_register(struct list_item *peers, struct poller *poller,
+              struct kad_ctx *kctx, int conn,
+              const struct sockaddr_storage *addr)
 {
     struct peer *peer = calloc(1, sizeof(struct peer));
     if (!peer) {
@@ -117,6 +169,16 @@ peer_register(struct list_item *peers, int conn, const struct sockaddr_storage *
         return NULL;
     }
 
+    if (!poller_add(poller, conn, POLLER_IN, peer)) {
+        free_safer(peer);
+        return NULL;
+    }
+
+    peer->event = (struct event){
+        "peer-data", .cb=event_peer_data_cb,
+        .args.peer_data={.peer=peer, .poller=poller, .kctx=kctx},
+        .fatal=true, .self=NULL
+    };
     peer->fd = conn;
     peer->addr = *addr;
     sockaddr_storage_fmt(peer->addr_str, &peer->addr);
@@ -134,13 +196,15 @@ peer_register(struct list_item *peers, int conn, const struct sockaddr_storage *
  * Returns 0 on success, -1 on error, 1 when max_peers reached.
  */
 int peer_conn_accept_all(const int listenfd, struct list_item *peers,
-                         const int nfds, const struct config *conf)
+                         struct poller *poller, struct kad_ctx *kctx,
+                         const struct config *conf)
 {
     struct sockaddr_storage peer_addr = {0};
     socklen_t peer_addr_len = sizeof(peer_addr);
     int conn = -1;
     int fail = 0, skipped = 0;
-    int npeer = nfds;
+    // registered fds, including listening sockets
+    int npeer = poller->len;
     do {
         conn = accept(listenfd, (struct sockaddr *)&peer_addr, &peer_addr_len);
         if (conn < 0) {
@@ -165,7 +229,7 @@ int peer_conn_accept_all(const int listenfd, struct list_item *peers,
             continue;
         }
 
-        struct peer *p = peer_register(peers, conn, &peer_addr);
+        struct peer *p = peer_register(peers, poller, kctx, conn, &peer_addr);
         if (!p) {
             log_error("Failed to register peer fd=%d."
                       " Trying to close connection gracefully.", conn);
@@ -190,35 +254,12 @@ int peer_conn_accept_all(const int listenfd, struct list_item *peers,
         return 0;
 }
 
-struct peer*
-peer_find_by_fd(struct list_item *peers, const int fd)
-{
-    struct peer *p;
-    struct list_item * it = peers;
-    list_for(it, peers) {
-        p = cont(it, struct peer, item);
-        if (!p) {
-            log_error("Undefined container in list.");
-            return NULL;
-        }
-        if (p->fd == fd)
-            break;
-    }
-
-    if (it == peers) {
-        log_warning("Peer not found fd=%d.", fd);
-        return NULL;
-    }
-
-    return p;
-}
-
-static void peer_unregister(struct peer *peer)
+static void peer_unregister(struct peer *peer, struct poller *poller)
 {
     log_debug("Unregistering peer %s.", peer->addr_str);
+    poller_del(poller, peer->fd);
     proto_msg_parser_terminate(&peer->parser);
     list_delete(&peer->item);
-    free_safer(peer);
 }
 
 static bool peer_msg_send(const struct peer *peer, enum proto_msg_type typ,
@@ -304,24 +345,26 @@ int peer_conn_handle_data(struct peer *peer, struct kad_ctx *kctx)
     return ret;
 }
 
-bool peer_conn_close(struct peer *peer)
+bool peer_conn_close(struct peer *peer, struct poller *poller)
 {
     bool ret = true;
     log_info("Closing connection with peer %s.", peer->addr_str);
+    // Unregister before closing, as epoll needs a valid fd.
+    peer_unregister(peer, poller);
     if (!sock_close(peer->fd)) {
         log_perror(LOG_ERR, "Failed closed for peer: %s.", errno);
         ret = false;
     }
-    peer_unregister(peer);
+    free_safer(peer);
     return ret;
 }
 
-int peer_conn_close_all(struct list_item *peers)
+int peer_conn_close_all(struct list_item *peers, struct poller *poller)
 {
     int fail = 0;
     while (!list_is_empty(peers)) {
         struct peer *p = cont(peers->prev, struct peer, item);
-        if (!peer_conn_close(p))
+        if (!peer_conn_close(p, poller))
             fail++;
     }
     return fail;
@@ -338,7 +381,14 @@ int peer_conn_close_all(struct list_item *peers)
    are then ping'd and then added to the routes. In recent implementations,
    router nodes are handled differently than normal nodes.
 */
-static bool kad_lookup_start(const kad_guid target, struct kad_ctx *ctx);
+static void kad_bootstrap_complete(const struct kad_lookup_result *result,
+                                   void *data)
+{
+    (void)data;
+    log_info("Bootstrap lookup complete: %zu closest nodes, %d rounds, %lld ms.",
+             result->nodes_len, result->stats.rounds, result->stats.elapsed);
+}
+
 bool kad_bootstrap(const struct config *conf, struct kad_ctx *kctx)
 {
     char bootstrap_nodes_path[PATH_MAX];
@@ -381,12 +431,57 @@ bool kad_bootstrap(const struct config *conf, struct kad_ctx *kctx)
             log_error("Could not insert bootstrap node to routes.");
     }
 
-    return kad_lookup_start(kctx->routes->self_id, kctx);
+    return kad_lookup_start(kctx, kctx->routes->self_id,
+                            kad_bootstrap_complete, NULL);
+}
+
+/**
+ * Arms the per-query timeout. The event only carries the query's tx_id, as the
+ * query may be gone by the time the event is dispatched.
+ */
+static bool kad_query_arm_timeout(struct kad_ctx *kctx,
+                                  struct kad_rpc_query *query)
+{
+    struct event *evt = event_pool_get(kctx->timers->events);
+    if (!evt)
+        return false;
+    *evt = (struct event){
+        "kad-query-timeout", .cb=event_kad_query_timeout_cb,
+        .args.kad_query_timeout={.tx_id=query->msg.tx_id, .kctx=kctx},
+        .fatal=false, .self=evt
+    };
+    query->timeout = (struct timer){
+        .name="kad-query-timeout", .once=true,
+        .delay=KAD_RPC_QUERY_TIMEOUT_MILLIS, .event=evt
+    };
+    if (!timer_init(kctx->timers, &query->timeout, query->created)) {
+        list_init(&query->timeout.item);
+        event_pool_put(kctx->timers->events, evt);
+        return false;
+    }
+    return true;
+}
+
+bool kad_query_timeout(struct kad_ctx *kctx, const kad_rpc_msg_tx_id tx_id)
+{
+    struct kad_rpc_query *query = NULL;
+    if (!req_lru_delete(kctx->reqs_out, tx_id, &query))
+        return true; // responded to or evicted meanwhile
+
+    LOG_FMT_HEX_DECL(tx_id_str, KAD_RPC_MSG_TX_ID_LEN);
+    log_fmt_hex(tx_id_str, KAD_RPC_MSG_TX_ID_LEN, tx_id.bytes);
+    ADDR_STR_DECL(addr);
+    log_info("Query to %s timed out (id=%s).",
+             compact_addr_fmt_log(addr, &query->node.addr, LOG_INFO), tx_id_str);
+    routes_mark_stale(kctx->routes, &query->node.id);
+    kad_rpc_query_free(kctx, query);
+    return true;
 }
 
 static bool kad_query(struct kad_ctx *kctx,
                       const struct kad_node_info node,
-                      const struct kad_rpc_msg msg)
+                      const struct kad_rpc_msg msg,
+                      unsigned lookup_id)
 {
     struct kad_rpc_query *query = calloc(1, sizeof(struct kad_rpc_query));
     if (!query) {
@@ -395,6 +490,7 @@ static bool kad_query(struct kad_ctx *kctx,
     }
     memcpy(&query->node, &node, sizeof(struct kad_node_info));
     memcpy(&query->msg, &msg, sizeof(struct kad_rpc_msg));
+    query->lookup_id = lookup_id;
 
     struct iobuf qbuf = {0};
     if (!kad_rpc_query_create(&qbuf, query, kctx)) {
@@ -403,17 +499,14 @@ static bool kad_query(struct kad_ctx *kctx,
 
     LOG_FMT_HEX_DECL(tx_id, KAD_RPC_MSG_TX_ID_LEN);
     log_fmt_hex(tx_id, KAD_RPC_MSG_TX_ID_LEN, query->msg.tx_id.bytes);
-    log_info("Sending kad msg [%d] to %s (id=%s)", query->msg.meth, node.addr_str, tx_id);
+    ADDR_STR_DECL(addr);
+    log_info("Sending kad msg [%d] to %s (id=%s)", query->msg.meth,
+             compact_addr_fmt_log(addr, &node.addr, LOG_INFO), tx_id);
 
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    ssize_t slen = sendto(kctx->sock, qbuf.buf, qbuf.len, 0, (struct sockaddr *)&node.addr, addr_len);
-    if (slen < 0) {
-        if (errno != EWOULDBLOCK) {
-            log_perror(LOG_ERR, "Failed sendto: %s", errno);
-        }
+    struct sockaddr_storage ss;
+    if (!compact_addr_to_sockaddr(&ss, &node.addr) ||
+        !kad_send(kctx, qbuf.buf, qbuf.len, &ss))
         goto failed;
-    }
-    log_debug("Sent %d bytes.", slen);
     iobuf_reset(&qbuf);
 
     struct kad_rpc_query *evicted = NULL;
@@ -422,17 +515,20 @@ static bool kad_query(struct kad_ctx *kctx,
         goto failed;
     }
     if (evicted) {
-        long long now = now_millis();
-        if (now < 0)
-            goto failed;
-        if (evicted->created + KAD_RPC_QUERY_TIMEOUT_MILLIS < now)
-            routes_mark_stale(kctx->routes, &evicted->node.id);
+        // Not timed out yet, otherwise it'd be gone already.
+        kad_rpc_query_free(kctx, evicted);
         log_info("Evicted query from full list.");
     }
 
-    bool is_lookup_query = query->msg.meth == KAD_RPC_METH_FIND_NODE;
-    if (is_lookup_query && !kad_lookup_par_add(&kctx->lookup, query))
-        log_error("Already %d find_node requests in-flight.", kctx->lookup.par_len);
+    if (!kad_query_arm_timeout(kctx, query))
+        log_warning("Query (id=%s) won't time out.", tx_id);
+
+    struct kad_lookup *lookup = kad_lookups_get(&kctx->lookups, lookup_id);
+    if (lookup) {
+        lookup->result.stats.queries++;
+        if (!kad_lookup_par_add(lookup, query))
+            log_error("Already %d find_node requests in-flight.", lookup->par_len);
+    }
 
     iobuf_reset(&qbuf);
     return true;
@@ -448,96 +544,99 @@ bool kad_ping(struct kad_ctx *kctx, const struct kad_node_info node)
     struct kad_rpc_msg msg = {
         .meth=KAD_RPC_METH_PING
     };
-    return kad_query(kctx, node, msg);
+    return kad_query(kctx, node, msg, 0);
 }
 
 
 bool kad_find_node(struct kad_ctx *kctx, const struct kad_node_info node,
-                   const kad_guid target)
+                   const kad_guid target, unsigned lookup_id)
 {
+    struct kad_lookup *lookup = kad_lookups_get(&kctx->lookups, lookup_id);
+    if (lookup && lookup->sched > 0)
+        lookup->sched--;
+
     struct kad_rpc_msg msg = {
         .meth=KAD_RPC_METH_FIND_NODE,
         .target=target
     };
-    return kad_query(kctx, node, msg);
+    return kad_query(kctx, node, msg, lookup_id);
 }
 
 static bool kad_schedule_find_nodes(
-    const kad_guid target,
+    struct kad_lookup *lookup,
     const struct kad_node_info nodes[], size_t nodes_len,
     struct kad_ctx *kctx)
 {
-    long long now = now_millis();
+    long long now = tick_millis();
     if (now < 0)
         return false;
 
-    struct list_item timers_tmp;
-    list_init(&timers_tmp);
-
+    // All-or-nothing: timers are only armed once everything is allocated.
     struct event *events[nodes_len];
+    struct timer *timers[nodes_len];
     size_t i=0;
     for (; i<nodes_len; i++) {
-        events[i] = malloc(sizeof(struct event));
-        if (!events[i]) {
-            log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+        events[i] = event_pool_get(kctx->timers->events);
+        timers[i] = timer_pool_get(kctx->timers->pool);
+        if (!events[i] || !timers[i]) {
+            if (events[i])
+                event_pool_put(kctx->timers->events, events[i]);
+            if (timers[i])
+                timer_pool_put(kctx->timers->pool, timers[i]);
             goto cleanup;
         }
         *events[i] = (struct event){
             "kad-find-node", .cb=event_kad_find_node_cb,
-            .args.kad_find_node={.target=target, .node=nodes[i], .kctx=kctx},
+            .args.kad_find_node={.target=lookup->target, .node=nodes[i],
+                                 .lookup_id=lookup->id, .kctx=kctx},
             .fatal=false, .self=events[i]
         };
-        sockaddr_storage_fmt(events[i]->args.kad_find_node.node.addr_str,
-                             &events[i]->args.kad_find_node.node.addr);
 
-        struct timer *timer = malloc(sizeof(struct timer));
-        if (!timer) {
-            log_perror(LOG_ERR, "Failed malloc: %s.", errno);
-            goto cleanup;
-        }
-        *timer = (struct timer){
+        *timers[i] = (struct timer){
             .name="kad-find-node", .once=true,
             .delay=0 /* not speading the queries for now */,
-            .event=events[i], .self=timer
+            .event=events[i], .self=timers[i]
         };
-        timer_init(&timers_tmp, timer, now);
     }
 
-    list_concat(kctx->timers, &timers_tmp);
+    for (size_t j=0; j<nodes_len; j++)
+        timer_init(kctx->timers, timers[j], now);
+    lookup->sched += nodes_len;
     return true;
 
   cleanup:
-    for (size_t j=0; j<i; j++)
-        free(events[j]);
-    list_free_all((&timers_tmp), struct timer, item);
+    for (size_t j=0; j<i; j++) {
+        event_pool_put(kctx->timers->events, events[j]);
+        timer_pool_put(kctx->timers->pool, timers[j]);
+    }
     return false;
 }
 
-static bool kad_schedule_timeout(const int round, struct kad_ctx *ctx)
+static bool kad_schedule_timeout(const struct kad_lookup *lookup,
+                                 struct kad_ctx *ctx)
 {
-    long long now = now_millis();
+    long long now = tick_millis();
     if (now < 0)
         return false;
 
-    struct event *evt = malloc(sizeof(struct event));
-    if (!evt) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
-        goto cleanup;
-    }
+    struct event *evt = event_pool_get(ctx->timers->events);
+    if (!evt)
+        return false;
     *evt = (struct event){
         "kad-lookup", .cb=event_kad_lookup_cb,
-        .args.kad_lookup={.round=round, .kctx=ctx},
+        .args.kad_lookup={.id=lookup->id, .round=lookup->round, .kctx=ctx},
         .fatal=false, .self=evt
     };
 
-    if (!set_timeout(ctx->timers, KAD_LOOKUP_TIMEOUT_MILLIS, true, evt))
-        goto cleanup;
+    int timeout = kad_rtt_est_timeout(&ctx->rtt);
+    log_debug("Lookup %u round %d times out in %d ms.", lookup->id,
+              lookup->round, timeout);
+    if (!set_timeout(ctx->timers, timeout, true, evt)) {
+        event_pool_put(ctx->timers->events, evt);
+        return false;
+    }
 
     return true;
-
-  cleanup:
-    free_safer(evt);
-    return false;
 }
 
 /* https://blog.libtorrent.org/2014/11/dht-routing-table-maintenance/ */
@@ -548,94 +647,160 @@ bool kad_refresh(void *data)
     return true;
 }
 
-static void kad_lookup_complete(struct kad_ctx *ctx)
+/**
+ * Ends @lookup, then hands its result to its callback: the callback may thus
+ * start another lookup.
+ */
+static void kad_lookup_complete(struct kad_ctx *ctx, struct kad_lookup *lookup)
 {
-    // TODO return the k closest nodes to target from lookup.past
-    kad_lookup_reset(&ctx->lookup);
-    log_debug("Lookup complete.");
+    kad_lookup_finish(lookup, tick_millis());
+    log_debug("Lookup %u complete: %zu/%zu responses, %lld ms.", lookup->id,
+              lookup->result.stats.responses, lookup->result.stats.queries,
+              lookup->result.stats.elapsed);
+
+    kad_lookup_cb cb = lookup->cb;
+    void *cb_data = lookup->cb_data;
+    struct kad_lookup_result result = lookup->result;
+    kad_lookups_end(&ctx->lookups, lookup);
+    if (cb)
+        cb(&result, cb_data);
 }
 
 static void
-lookup_past_insert(struct kad_ctx *ctx,
+lookup_past_insert(struct kad_lookup *lookup,
                    struct kad_node_lookup *contacted[], size_t contacted_len)
 {
     for (size_t i = 0; i < contacted_len; ++i)
-        if (!node_heap_push(&ctx->lookup.past, contacted[i])) {
-            log_error("Failed insert into lookup past nodes.");
-            free_safer(contacted[i]);
-        }
+        kad_lookup_past_insert(lookup, contacted[i]);
 }
 
 static bool
-kad_lookup_send(struct kad_node_info next[], size_t next_len,
-                const kad_guid target, struct kad_ctx *ctx)
+kad_lookup_send(struct kad_lookup *lookup,
+                struct kad_node_info next[], size_t next_len,
+                struct kad_ctx *ctx)
 {
-    // FIXME in kad_lookup_recv() ?
-    if (ctx->lookup.round >= KAD_K_CONST) {
-        kad_lookup_complete(ctx);
+    if (tick_millis() >= lookup->deadline) {
+        log_debug("Lookup %u past its deadline.", lookup->id);
+        kad_lookup_complete(ctx, lookup);
         return true;
     }
 
     if (next_len == 0) {
-        log_debug("Lookup nodes exhausted.");
-        kad_lookup_complete(ctx);
-        return true;
+        if (kad_lookup_par_is_empty(lookup) && lookup->sched == 0) {
+            log_debug("Lookup nodes exhausted.");
+            kad_lookup_complete(ctx, lookup);
+            return true;
+        }
+        // Wait for queries in flight, a round at most.
+        return kad_schedule_timeout(lookup, ctx);
     }
 
     log_debug("Scheduling %d find_node lookups.", next_len);
-    if (!kad_schedule_find_nodes(target, next, next_len, ctx))
+    if (!kad_schedule_find_nodes(lookup, next, next_len, ctx))
         return false;
 
-    return kad_schedule_timeout(ctx->lookup.round, ctx);
+    return kad_schedule_timeout(lookup, ctx);
 }
 
-static bool kad_lookup_start(const kad_guid target, struct kad_ctx *ctx)
+/**
+ * Queries the first α nodes of the routing table for @lookup's target.
+ *
+ * Nodes are only queried once per lookup: those seen already are skipped.
+ */
+static bool kad_lookup_seed(struct kad_lookup *lookup, struct kad_ctx *ctx)
 {
-    log_debug("Lookup start, round=%d", ctx->lookup.round);
+    log_debug("Lookup %u seed, round=%d", lookup->id, lookup->round);
     struct kad_node_info next[KAD_K_CONST] = {0};
     size_t next_len = 0;
 
-    if (!kad_lookup_par_is_empty(&ctx->lookup)) {
+    if (!kad_lookup_par_is_empty(lookup)) {
         log_error("Lookup start: in-flight list not empty.");
         return false;
     }
 
-    next_len = routes_find_closest(ctx->routes, next,
-                                   &ctx->routes->self_id, NULL);
-    if (next_len > KAD_ALPHA_CONST)
-        next_len = KAD_ALPHA_CONST;
+    size_t found_len = routes_find_closest(ctx->routes, next, &lookup->target,
+                                           NULL);
+    int rtts[KAD_K_CONST];
+    for (size_t i = 0; i < found_len; ++i)
+        rtts[i] = routes_rtt(ctx->routes, &next[i].id);
+    kad_lookup_rank_nodes(next, rtts, found_len, &lookup->target);
+
+    kad_seen_add(&lookup->seen, &ctx->routes->self_id);
+    for (size_t i = 0; i < found_len && next_len < KAD_ALPHA_CONST; ++i) {
+        if (!kad_seen_add(&lookup->seen, &next[i].id))
+            continue;
+        next[next_len] = next[i];
+        rtts[next_len] = rtts[i];
+        next_len++;
+    }
 
     struct kad_node_lookup *contacted[KAD_K_CONST] = {0};
     for (size_t i = 0; i < next_len; ++i)
-        contacted[i] = kad_lookup_new_from(&next[i], target);
+        contacted[i] = kad_lookup_new_from(lookup, &next[i], lookup->target,
+                                           rtts[i]);
 
-    lookup_past_insert(ctx, contacted, next_len);
+    lookup_past_insert(lookup, contacted, next_len);
 
-    return kad_lookup_send(next, next_len, target, ctx);
+    return kad_lookup_send(lookup, next, next_len, ctx);
 }
 
-bool kad_lookup_next(const kad_guid target, struct kad_ctx *ctx)
+/**
+ * Starts a lookup for @target. @cb, if any, gets the k closest nodes which
+ * responded, along with @data, when the lookup completes.
+ *
+ * Fails when a lookup for @target is already running, or too many lookups
+ * are. @cb isn't called then.
+ */
+bool kad_lookup_start(struct kad_ctx *ctx, const kad_guid target,
+                      kad_lookup_cb cb, void *data)
 {
-    log_debug("Lookup send, round=%d", ctx->lookup.round);
+    if (kad_lookups_find(&ctx->lookups, &target)) {
+        log_info("Lookup for target already running.");
+        return false;
+    }
+
+    long long now = tick_millis();
+    if (now < 0)
+        return false;
+
+    struct kad_lookup *lookup = kad_lookups_new(&ctx->lookups, &target, now);
+    if (!lookup) {
+        log_warning("Too many concurrent lookups (%zu).", ctx->lookups.len);
+        return false;
+    }
+    lookup->cb = cb;
+    lookup->cb_data = data;
+
+    if (!kad_lookup_seed(lookup, ctx)) {
+        kad_lookups_end(&ctx->lookups, lookup);
+        return false;
+    }
+    return true;
+}
+
+bool kad_lookup_next(unsigned id, struct kad_ctx *ctx)
+{
+    struct kad_lookup *lookup = kad_lookups_get(&ctx->lookups, id);
+    if (!lookup)
+        return true; // completed meanwhile
+
+    if (kad_lookup_converged(lookup)) {
+        log_debug("Lookup %u converged.", id);
+        kad_lookup_complete(ctx, lookup);
+        return true;
+    }
+
+    log_debug("Lookup %u send, round=%d", id, lookup->round);
     struct kad_node_info next[KAD_K_CONST] = {0};
     size_t next_len = 0;
 
+    // Expired queries are removed by their own timeout.
     struct kad_node_lookup *contacted[KAD_K_CONST] = {0};
-    for (size_t i = 0; i < ctx->lookup.par_len; ++i) {
-        struct kad_rpc_query *query = ctx->lookup.par[i];
-        if (query != NULL) {
-            long long now = now_millis();
-            if (now >= 0 && query->created + KAD_RPC_QUERY_TIMEOUT_MILLIS < now) {
-                routes_mark_stale(ctx->routes, &query->node.id);
-                free_safer(query);
-                query = NULL;
-            }
-            continue;
-        }
-
-        struct kad_node_lookup *nl = node_heap_pop(&ctx->lookup.next);
+    size_t free_len = kad_lookup_par_free(lookup);
+    for (size_t i = 0; i < free_len; ++i) {
+        struct kad_node_lookup *nl = node_heap_pop(&lookup->next);
         if (!nl)
-            continue;
+            break;
 
         next[next_len].id = nl->id;
         next[next_len].addr = nl->addr;
@@ -645,44 +810,51 @@ bool kad_lookup_next(const kad_guid target, struct kad_ctx *ctx)
         next_len++;
     }
 
-    lookup_past_insert(ctx, contacted, next_len);
+    lookup_past_insert(lookup, contacted, next_len);
 
-    return kad_lookup_send(next, next_len, target, ctx);
+    if (!kad_lookup_send(lookup, next, next_len, ctx)) {
+        kad_lookup_complete(ctx, lookup);
+        return false;
+    }
+    return true;
 }
 
-static void lookup_par_discard(struct kad_ctx *ctx)
+/**
+ * Stops waiting for @lookup's queries in flight. They are kept in the request
+ * list until their own timeout, so that late responses still feed the RTT
+ * estimates and the lookup.
+ */
+static void lookup_par_discard(struct kad_lookup *lookup)
 {
-    for (size_t i = 0; i < KAD_K_CONST; ++i) {
-        struct kad_rpc_query *query = ctx->lookup.par[i];
-        if (!query)
-            continue;
-        if (!req_lru_delete(ctx->reqs_out, query->msg.tx_id, &query)) {
-            LOG_FMT_HEX_DECL(tx_id, KAD_RPC_MSG_TX_ID_LEN);
-            log_fmt_hex(tx_id, KAD_RPC_MSG_TX_ID_LEN, query->msg.tx_id.bytes);
-            log_error("In-flight query (tx_id=%s) not found in request list.", tx_id);
-        }
-        free_safer(query);
-        ctx->lookup.par[i] = NULL;
-    }
+    memset(lookup->par, 0, sizeof(lookup->par));
 }
 
-bool kad_lookup_timeout(const int round, struct kad_ctx *ctx)
+bool kad_lookup_timeout(unsigned id, const int round, struct kad_ctx *ctx)
 {
-    if (round < ctx->lookup.round)
+    struct kad_lookup *lookup = kad_lookups_get(&ctx->lookups, id);
+    if (!lookup || round < lookup->round)
         return true;
 
-    if (round > ctx->lookup.round) {
-        log_error("Lookup timeout for round %d triggered during prior round %d.", round, ctx->lookup.round);
+    if (round > lookup->round) {
+        log_error("Lookup timeout for round %d triggered during prior round %d.", round, lookup->round);
         return false;
     }
 
-    if (kad_lookup_par_is_empty(&ctx->lookup)) {
-        log_debug("Lookup timeout for round %d: no queries in flight.", round);
-        return true;
+    if (lookup->mode == KAD_LOOKUP_PAR_LOOSE &&
+        lookup->par_len < KAD_K_CONST && !kad_lookup_par_is_empty(lookup)) {
+        // Query more nodes rather than wait for these.
+        lookup->par_len = lookup->par_len + KAD_ALPHA_CONST < KAD_K_CONST ?
+            lookup->par_len + KAD_ALPHA_CONST : KAD_K_CONST;
+        lookup->round += 1;
+        log_debug("Lookup timeout for round %d: par_len=%zu.", round,
+                  lookup->par_len);
+    }
+    else {
+        // Carry on with the nodes learned so far: re-seeding would only
+        // query the same nodes again.
+        lookup_par_discard(lookup);
+        kad_lookup_iterate(lookup);
     }
 
-    lookup_par_discard(ctx);
-
-    return kad_lookup_start(ctx->lookup.past.buf[0]->target, ctx);
-
+    return kad_lookup_next(id, ctx);
 }
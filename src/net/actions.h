@@ -7,13 +7,33 @@
  */
 #include <netinet/in.h>
 #include "events.h"
+#include "net/dgram.h"
 #include "net/kad/rpc.h"
 #include "net/msg.h"
 #include "options.h"
+#include "poller.h"
 #include "utils/list.h"
 
+#define SERVER_UDP_BUFLEN DGRAM_BUFLEN
+#define SERVER_UDP_BATCH_LEN 32
+
 enum conn_ret {CONN_OK, CONN_CLOSED};
 
+/**
+ * Preallocated buffers for draining the UDP socket in batches (recvmmsg(2)
+ * when available), so that a burst of datagrams is handled within one loop
+ * iteration.
+ */
+struct node_recv {
+    char                    bufs[SERVER_UDP_BATCH_LEN][SERVER_UDP_BUFLEN];
+    size_t                  lens[SERVER_UDP_BATCH_LEN];
+    struct sockaddr_storage addrs[SERVER_UDP_BATCH_LEN];
+    /* Datagrams-per-wakeup stats */
+    unsigned long long      wakeups;
+    unsigned long long      datagrams;
+    size_t                  batch_max;
+};
+
 struct addr_list {
     struct sockaddr_storage addr;
     struct list_item item;
@@ -31,23 +51,27 @@ struct peer {
     // used for logging = addr:port in hex
     char                    addr_str[32+1+4+1];
     struct proto_msg_parser parser;
+    /* Queued when @fd is readable. */
+    struct event            event;
 };
 
-bool node_handle_data(struct kad_ctx *kctx);
-bool kad_response(int sock, struct iobuf *rsp, struct sockaddr_storage addr);
+bool node_handle_data(struct kad_ctx *kctx, struct node_recv *nrecv);
+bool node_flush_data(struct kad_ctx *kctx, struct poller *poller);
 
-struct peer* peer_find_by_fd(struct list_item *peers, const int fd);
 int peer_conn_accept_all(const int listenfd, struct list_item *peers,
-                         const int nfds, const struct config *conf);
+                         struct poller *poller, struct kad_ctx *kctx,
+                         const struct config *conf);
 int peer_conn_handle_data(struct peer *peer, struct kad_ctx *kctx);
-bool peer_conn_close(struct peer *peer);
-int peer_conn_close_all(struct list_item *peers);
+bool peer_conn_close(struct peer *peer, struct poller *poller);
+int peer_conn_close_all(struct list_item *peers, struct poller *poller);
 
 bool kad_bootstrap(const struct config *conf, struct kad_ctx *kctx);
+bool kad_query_timeout(struct kad_ctx *kctx, const kad_rpc_msg_tx_id tx_id);
 bool kad_ping(struct kad_ctx *kctx, const struct kad_node_info node);
-bool kad_find_node(struct kad_ctx *kctx, const struct kad_node_info node, const kad_guid target);
-bool kad_lookup_next(const kad_guid target, struct kad_ctx *ctx);
-bool kad_lookup_timeout(const int round, struct kad_ctx *ctx);
+bool kad_find_node(struct kad_ctx *kctx, const struct kad_node_info node, const kad_guid target, unsigned lookup_id);
+bool kad_lookup_start(struct kad_ctx *ctx, const kad_guid target, kad_lookup_cb cb, void *data);
+bool kad_lookup_next(unsigned id, struct kad_ctx *ctx);
+bool kad_lookup_timeout(unsigned id, const int round, struct kad_ctx *ctx);
 bool kad_refresh(void *data);
 
 #endif /* ACTIONS_H */
@@ -0,0 +1,105 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#define _GNU_SOURCE  // sendmmsg
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "log.h"
+#include "net/dgram.h"
+
+bool dgram_queue_put(struct dgram_queue *q, const char buf[], size_t len,
+                     const struct sockaddr_storage *addr)
+{
+    if (len > DGRAM_BUFLEN) {
+        log_error("Datagram too large (%zu).", len);
+        q->dropped++;
+        return false;
+    }
+    if (dgram_queue_is_full(q)) {
+        log_warning("Send queue full, dropping datagram.");
+        q->dropped++;
+        return false;
+    }
+
+    struct dgram *d = &q->entries[(q->head + q->len) % DGRAM_QUEUE_LEN];
+    memcpy(d->buf, buf, len);
+    d->len = len;
+    d->addr = *addr;
+    q->len++;
+    if (q->len > q->len_max)
+        q->len_max = q->len;
+
+    return true;
+}
+
+static void dgram_queue_pop(struct dgram_queue *q, size_t n)
+{
+    q->head = (q->head + n) % DGRAM_QUEUE_LEN;
+    q->len -= n;
+}
+
+/**
+ * Sends the datagrams at the head of the queue, in a single syscall when
+ * possible.
+ *
+ * Returns the number of datagrams sent, or -1 on error (errno set).
+ */
+static int dgram_queue_send(struct dgram_queue *q, int sock)
+{
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[DGRAM_QUEUE_LEN];
+    struct iovec iovecs[DGRAM_QUEUE_LEN];
+    memset(msgs, 0, sizeof(struct mmsghdr) * q->len);
+    for (size_t i = 0; i < q->len; i++) {
+        struct dgram *d = &q->entries[(q->head + i) % DGRAM_QUEUE_LEN];
+        iovecs[i].iov_base = d->buf;
+        iovecs[i].iov_len = d->len;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &d->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    return sendmmsg(sock, msgs, q->len, 0);
+#else
+    int n = 0;
+    for (; (size_t)n < q->len; n++) {
+        struct dgram *d = &q->entries[(q->head + n) % DGRAM_QUEUE_LEN];
+        if (sendto(sock, d->buf, d->len, 0, (struct sockaddr *)&d->addr,
+                   sizeof(struct sockaddr_storage)) < 0)
+            return n > 0 ? n : -1;
+    }
+    return n;
+#endif
+}
+
+size_t dgram_queue_flush(struct dgram_queue *q, int sock)
+{
+    size_t sent = 0;
+    q->blocked = false;
+    if (dgram_queue_is_empty(q))
+        return 0;
+
+    q->flushes++;
+    while (!dgram_queue_is_empty(q)) {
+        int n = dgram_queue_send(q, sock);
+        if (n < 0) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                log_debug("Send would block, %zu datagrams kept.", q->len);
+                q->blocked = true;
+                break;
+            }
+            else if (errno == EINTR)
+                continue;
+            log_perror(LOG_ERR, "Failed sendmmsg: %s", errno);
+            dgram_queue_pop(q, 1);
+            q->dropped++;
+            continue;
+        }
+        dgram_queue_pop(q, n);
+        sent += n;
+    }
+    q->sent += sent;
+    log_debug("Sent %zu datagrams.", sent);
+
+    return sent;
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#ifndef DGRAM_H
+#define DGRAM_H
+
+/**
+ * Outbound datagram queue.
+ *
+ * Datagrams produced during a loop iteration (KRPC responses and queries) are
+ * copied into a ring of fixed-size slots, and flushed at once with
+ * sendmmsg(2) when available. When the socket would block, unsent datagrams
+ * remain queued and the queue is marked @blocked, so that the caller can wait
+ * for writability before the next flush.
+ */
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DGRAM_BUFLEN 1400
+#define DGRAM_QUEUE_LEN 64
+
+struct dgram {
+    struct sockaddr_storage addr;
+    size_t                  len;
+    char                    buf[DGRAM_BUFLEN];
+};
+
+struct dgram_queue {
+    struct dgram       entries[DGRAM_QUEUE_LEN];
+    size_t             head;
+    size_t             len;
+    bool               blocked;
+    bool               out_armed;  // caller waits for writability
+    /* Stats */
+    unsigned long long flushes;
+    unsigned long long sent;
+    unsigned long long dropped;
+    size_t             len_max;
+};
+
+static inline bool dgram_queue_is_empty(const struct dgram_queue *q)
+{
+    return q->len == 0;
+}
+
+static inline bool dgram_queue_is_full(const struct dgram_queue *q)
+{
+    return q->len == DGRAM_QUEUE_LEN;
+}
+
+/**
+ * Copies @buf into the queue.
+ *
+ * Returns false when the queue is full or @len is too large.
+ */
+bool dgram_queue_put(struct dgram_queue *q, const char buf[], size_t len,
+                     const struct sockaddr_storage *addr);
+
+/**
+ * Sends as many queued datagrams as possible on @sock.
+ *
+ * Datagrams rejected by the kernel for other reasons than EWOULDBLOCK are
+ * dropped, so that a single bad destination doesn't stall the queue.
+ *
+ * Returns the number of datagrams sent.
+ */
+size_t dgram_queue_flush(struct dgram_queue *q, int sock);
+
+#endif /* DGRAM_H */
@@ -71,35 +71,6 @@ benc_node_navigate_to_key(const struct benc_repr *repr,
     return n;
 }
 
-static bool benc_read_single_addr(struct sockaddr_storage *addr, char *p, size_t len)
-{
-    switch (len) {
-    case BENC_IP4_ADDR_LEN_IN_BYTES + 2: {
-        struct sockaddr_in *sa = (struct sockaddr_in*)addr;
-        sa->sin_family = AF_INET;
-        memcpy(&sa->sin_addr, (unsigned char*)p, BENC_IP4_ADDR_LEN_IN_BYTES);
-        p += BENC_IP4_ADDR_LEN_IN_BYTES;
-        memcpy(&sa->sin_port, (unsigned char*)p, 2);
-        break;
-    }
-
-    case BENC_IP6_ADDR_LEN_IN_BYTES + 2: {
-        struct sockaddr_in6 *sa6 = (struct sockaddr_in6*)addr;
-        sa6->sin6_family = AF_INET6;
-        memcpy(&sa6->sin6_addr, (unsigned char*)p, BENC_IP6_ADDR_LEN_IN_BYTES);
-        p += BENC_IP6_ADDR_LEN_IN_BYTES;
-        memcpy(&sa6->sin6_port, (unsigned char*)p, 2);
-        break;
-    }
-
-    default:
-        log_error("Failed to read single addr.");
-        return false;
-    }
-
-    return true;
-}
-
 int benc_read_nodes(const struct benc_repr *repr,
                     struct kad_node_info nodes[], const size_t nodes_len,
                     const struct benc_node *list)
@@ -125,16 +96,14 @@ int benc_read_nodes(const struct benc_repr *repr,
         }
 
         if (lit->s.len < KAD_GUID_SPACE_IN_BYTES ||
-            !benc_read_single_addr(&nodes[i].addr,
-                                   (char*)(lit->s.p + KAD_GUID_SPACE_IN_BYTES),
-                                   lit->s.len - KAD_GUID_SPACE_IN_BYTES)) {
+            !compact_addr_set(&nodes[i].addr,
+                              (unsigned char*)lit->s.p + KAD_GUID_SPACE_IN_BYTES,
+                              lit->s.len - KAD_GUID_SPACE_IN_BYTES)) {
             log_error("Invalid node info in position #%d.", i);
             return -1;
         }
         // only set guid when necessary
         kad_guid_set(&nodes[i].id, (unsigned char*)lit->s.p);
-
-        sockaddr_storage_fmt(nodes[i].addr_str, &nodes[i].addr);
     }
 
     return nnodes;
@@ -170,32 +139,18 @@ bool benc_write_nodes(struct iobuf *buf, const struct kad_node_info nodes[], siz
 {
     char tmps[64];
     for (size_t i = 0; i < nodes_len; i++) {
-        unsigned compact_len = 0;
-        unsigned char compact[21] = {0};
-        const struct sockaddr_storage *ss = &nodes[i].addr;
-        if (ss->ss_family == AF_INET) {
-            compact_len = 6;
-            const struct sockaddr_in *sa = (struct sockaddr_in *)ss;
-            memcpy(compact, (unsigned char*)&sa->sin_addr, 4);
-            memcpy(compact + 4, (unsigned char*)&sa->sin_port, 2);
-        }
-        else if (ss->ss_family == AF_INET6) {
-            compact_len = 18;
-            const struct sockaddr_in6 *sa = (struct sockaddr_in6 *)ss;
-            memcpy(compact, (unsigned char*)&sa->sin6_addr, 16);
-            memcpy(compact + 16, (unsigned char*)&sa->sin6_port, 2);
-        }
-        else {
-            log_error("Unsupported socket address family (%d).", ss->ss_family);
+        const struct compact_addr *ca = &nodes[i].addr;
+        if (ca->len != COMPACT_ADDR4_LEN && ca->len != COMPACT_ADDR6_LEN) {
+            log_error("Invalid compact addr length (%d).", ca->len);
             return false;
         }
 
-        sprintf(tmps, "%u:", KAD_GUID_SPACE_IN_BYTES + compact_len);
+        sprintf(tmps, "%u:", KAD_GUID_SPACE_IN_BYTES + ca->len);
         size_t tmps_len = strlen(tmps);
         memcpy(tmps + tmps_len, (char*)nodes[i].id.bytes, KAD_GUID_SPACE_IN_BYTES);
         tmps_len += KAD_GUID_SPACE_IN_BYTES;
         iobuf_append(buf, tmps, tmps_len);
-        iobuf_append(buf, (char*)compact, compact_len);
+        iobuf_append(buf, (char*)ca->bytes, ca->len);
     }
 
     return true;
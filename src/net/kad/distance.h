@@ -0,0 +1,115 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#ifndef KAD_DISTANCE_H
+#define KAD_DISTANCE_H
+
+/**
+ * XOR distance kernels on kad_guid.
+ *
+ * Ids are big-endian numbers: they are loaded as big-endian 64-bit words, so
+ * that a 160-bit id takes 3 loads (the last one zero-padded) instead of 20
+ * byte operations. Comparing distances then boils down to comparing integers,
+ * and counting leading zeros to a single instruction per word.
+ *
+ * These are in the innermost loop of lookups and find_node responses.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "net/kad/id.h"
+
+#define KAD_ID_WORD_BYTES 8
+#define KAD_ID_WORD_BITS  64
+#define KAD_ID_WORDS \
+    ((KAD_GUID_SPACE_IN_BYTES + KAD_ID_WORD_BYTES - 1) / KAD_ID_WORD_BYTES)
+
+/**
+ * Returns the @w-th big-endian word of @bytes, zero-padded past the id's
+ * length.
+ */
+static inline uint64_t kad_id_word(const unsigned char bytes[], size_t w)
+{
+    uint64_t word = 0;
+    size_t off = w * KAD_ID_WORD_BYTES;
+    size_t len = KAD_GUID_SPACE_IN_BYTES - off;
+    memcpy(&word, bytes + off, len < KAD_ID_WORD_BYTES ? len : KAD_ID_WORD_BYTES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * Compares 2 ids as numbers, which for distances is comparing distances.
+ *
+ * Returns a negative number if a < b, 0 if a == b, a positive int if a > b.
+ */
+static inline int kad_id_cmp(const kad_guid *a, const kad_guid *b)
+{
+    for (size_t w = 0; w < KAD_ID_WORDS; ++w) {
+        uint64_t wa = kad_id_word(a->bytes, w);
+        uint64_t wb = kad_id_word(b->bytes, w);
+        if (wa != wb)
+            return wa < wb ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Compares the distances of @a and @b to @target.
+ *
+ * Returns a negative number if @a is closer, 0 if a == b, a positive int if
+ * @b is closer.
+ */
+static inline int kad_distance_cmp(const kad_guid *target, const kad_guid *a,
+                                   const kad_guid *b)
+{
+    for (size_t w = 0; w < KAD_ID_WORDS; ++w) {
+        uint64_t wt = kad_id_word(target->bytes, w);
+        uint64_t da = kad_id_word(a->bytes, w) ^ wt;
+        uint64_t db = kad_id_word(b->bytes, w) ^ wt;
+        if (da != db)
+            return da < db ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Returns the number of leading zero bits of @a XOR @b, that is the length of
+ * their common prefix, up to KAD_ID_WORDS * KAD_ID_WORD_BITS if equal.
+ */
+static inline int kad_distance_clz(const kad_guid *a, const kad_guid *b)
+{
+    for (size_t w = 0; w < KAD_ID_WORDS; ++w) {
+        uint64_t x = kad_id_word(a->bytes, w) ^ kad_id_word(b->bytes, w);
+        if (x)
+            return w * KAD_ID_WORD_BITS + __builtin_clzll(x);
+    }
+    return KAD_ID_WORDS * KAD_ID_WORD_BITS;
+}
+
+/** Folds all words of @id, as ids may share long prefixes. */
+static inline uint32_t kad_id_hash(const kad_guid *id)
+{
+    uint64_t h = 0;
+    for (size_t w = 0; w < KAD_ID_WORDS; ++w)
+        h ^= kad_id_word(id->bytes, w);
+    return h ^ (h >> 32);
+}
+
+/** Puts the distance @a XOR @b into @out. */
+static inline void kad_distance(kad_guid *out, const kad_guid *a,
+                                const kad_guid *b)
+{
+    size_t i = 0;
+    for (; i + KAD_ID_WORD_BYTES <= KAD_GUID_SPACE_IN_BYTES;
+         i += KAD_ID_WORD_BYTES) {
+        uint64_t wa, wb;
+        memcpy(&wa, a->bytes + i, KAD_ID_WORD_BYTES);
+        memcpy(&wb, b->bytes + i, KAD_ID_WORD_BYTES);
+        wa ^= wb;
+        memcpy(out->bytes + i, &wa, KAD_ID_WORD_BYTES);
+    }
+    for (; i < KAD_GUID_SPACE_IN_BYTES; ++i)
+        out->bytes[i] = a->bytes[i] ^ b->bytes[i];
+}
+
+#endif /* KAD_DISTANCE_H */
@@ -1,13 +1,19 @@
 /* Copyright (c) 2020 Foudil Brétel.  All rights reserved. */
 #include "log.h"
-#include "utils/safer.h"
 #include "net/kad/lookup.h"
+#include "net/kad/rpc.h"
 
 void kad_lookup_init(struct kad_lookup *lookup)
 {
+    lookup->id = 0;
+    lookup->mode = KAD_LOOKUP_PAR_DEFAULT;
+    lookup->round = 0;
+    lookup->sched = 0;
     node_heap_init(&lookup->next, 32);
-    node_heap_init(&lookup->past, 32);
-    memset(lookup->par, 0, KAD_ALPHA_CONST);
+    lookup->past_len = 0;
+    memset(&lookup->seen, 0, sizeof(lookup->seen));
+    node_lookup_slab_init(&lookup->nodes);
+    memset(lookup->par, 0, sizeof(lookup->par));
     lookup->par_len = KAD_ALPHA_CONST;
 }
 
@@ -15,27 +21,23 @@ void kad_lookup_terminate(struct kad_lookup *lookup)
 {
     kad_lookup_reset(lookup);
     node_heap_reset(&lookup->next);
-    node_heap_reset(&lookup->past);
+    node_lookup_slab_release(&lookup->nodes);
 }
 
 void kad_lookup_reset(struct kad_lookup *lookup)
 {
     lookup->round = 0;
     lookup->par_len = KAD_ALPHA_CONST;
-    memset(lookup->par, 0, KAD_ALPHA_CONST);
-
-    while (lookup->next.len > 0) {
-        // log_error("___lookup reset: next.len=%ld", lookup->next.len);
-        struct kad_node_lookup *nl = node_heap_pop(&lookup->next);
-        // log_error("___lookup reset: next nl=%p", nl);
-        if (nl) free_safer(nl);
-    }
+    lookup->sched = 0;
+    memset(lookup->par, 0, sizeof(lookup->par));
 
-    while (lookup->past.len > 0) {
-        struct kad_node_lookup *nl = node_heap_pop(&lookup->past);
-        // log_error("___lookup reset: past nl=%p", nl);
-        if (nl) free_safer(nl);
-    }
+    // All nodes come from the slab: no need to pop them one by one.
+    memset(lookup->next.buf, 0, lookup->next.len * sizeof(*lookup->next.buf));
+    lookup->next.len = 0;
+    memset(lookup->past, 0, sizeof(lookup->past));
+    lookup->past_len = 0;
+    memset(&lookup->seen, 0, sizeof(lookup->seen));
+    node_lookup_slab_clear(&lookup->nodes);
 }
 
 bool kad_lookup_par_is_empty(const struct kad_lookup *lookup)
@@ -48,13 +50,19 @@ bool kad_lookup_par_is_empty(const struct kad_lookup *lookup)
     return i == par_len;
 }
 
-/** \param node pointing to existing request in reqs_out */
+/**
+ * \param node pointing to existing request in reqs_out
+ *
+ * The in-flight cap is enforced when scheduling queries (see
+ * kad_lookup_par_free()): as par_len may shrink meanwhile, any free slot
+ * will do.
+ */
 bool kad_lookup_par_add(struct kad_lookup *lookup, struct kad_rpc_query *query)
 {
     size_t i = 0;
-    while (i < lookup->par_len && lookup->par[i] != NULL)
+    while (i < KAD_K_CONST && lookup->par[i] != NULL)
         i++;
-    if (i == lookup->par_len)
+    if (i == KAD_K_CONST)
         return false;
     lookup->par[i] = query;
     return true;
@@ -71,16 +79,287 @@ bool kad_lookup_par_remove(struct kad_lookup *lookup, const struct kad_rpc_query
     return false;
 }
 
+/**
+ * Returns how many more queries @lookup may send: par_len minus those in
+ * flight or scheduled.
+ */
+size_t kad_lookup_par_free(const struct kad_lookup *lookup)
+{
+    size_t busy = lookup->sched;
+    for (size_t i = 0; i < KAD_K_CONST; ++i)
+        if (lookup->par[i])
+            busy++;
+    return busy < lookup->par_len ? lookup->par_len - busy : 0;
+}
+
+/**
+ * Called on each response, once learned nodes are queued. Returns true when
+ * @lookup should query its next nodes, which is a new round.
+ *
+ * Strict: waits for the round's other queries, then α nodes if the round
+ * brought closer nodes, k otherwise. Bounded: α in flight, no more. Loose: α
+ * again after closer nodes; otherwise keeps par_len, widened on round
+ * timeouts.
+ */
+bool kad_lookup_iterate(struct kad_lookup *lookup)
+{
+    if (lookup->mode == KAD_LOOKUP_PAR_STRICT &&
+        (!kad_lookup_par_is_empty(lookup) || lookup->sched > 0))
+        return false;
+
+    // next is ranked by distance class then RTT: its top isn't necessarily
+    // the closest.
+    bool closer = false;
+    for (size_t i = 0; lookup->past_len > 0 && i < lookup->next.len; ++i)
+        if (kad_distance_cmp(&lookup->target, &lookup->next.buf[i]->id,
+                             &lookup->past[0]->id) < 0) {
+            closer = true;
+            break;
+        }
+    switch (lookup->mode) {
+    case KAD_LOOKUP_PAR_STRICT:
+        if (lookup->next.len > 0 && lookup->past_len > 0)
+            lookup->par_len = closer ? KAD_ALPHA_CONST : KAD_K_CONST;
+        break;
+    case KAD_LOOKUP_PAR_BOUNDED:
+        lookup->par_len = KAD_ALPHA_CONST;
+        break;
+    case KAD_LOOKUP_PAR_LOOSE:
+        if (closer)
+            lookup->par_len = KAD_ALPHA_CONST;
+        break;
+    default:
+        break;
+    }
+    log_debug("lookup.par_len=%zu", lookup->par_len);
+
+    lookup->round += 1;
+    return true;
+}
+
+/**
+ * Tells whether the k closest nodes @lookup came across all responded: it
+ * has k responders, and no node queued, scheduled or in flight is closer
+ * than the k-th.
+ */
+bool kad_lookup_converged(const struct kad_lookup *lookup)
+{
+    const struct kad_lookup_result *res = &lookup->result;
+    if (res->nodes_len < KAD_K_CONST || lookup->sched > 0)
+        return false;
+
+    const kad_guid *kth = &res->nodes[KAD_K_CONST - 1].id;
+    for (size_t i = 0; i < lookup->next.len; ++i)
+        if (kad_distance_cmp(&lookup->target, &lookup->next.buf[i]->id, kth) < 0)
+            return false;
+    for (size_t i = 0; i < KAD_K_CONST; ++i)
+        if (lookup->par[i] &&
+            kad_distance_cmp(&lookup->target, &lookup->par[i]->node.id, kth) < 0)
+            return false;
+    return true;
+}
+
 struct kad_node_lookup *
-kad_lookup_new_from(const struct kad_node_info *info, const kad_guid target)
+kad_lookup_new_from(struct kad_lookup *lookup,
+                    const struct kad_node_info *info, const kad_guid target,
+                    int rtt)
 {
-    struct kad_node_lookup *nl = malloc(sizeof(struct kad_node_lookup));
-    if (!nl) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+    struct kad_node_lookup *nl = node_lookup_slab_get(&lookup->nodes);
+    if (!nl)
         return NULL;
-    }
     nl->target = target;
     nl->id = info->id;
     nl->addr = info->addr;
+    nl->rtt = rtt;
     return nl;
 }
+
+void kad_lookup_node_free(struct kad_lookup *lookup, struct kad_node_lookup *nl)
+{
+    node_lookup_slab_put(&lookup->nodes, nl);
+}
+
+/**
+ * Inserts queried node @nl into the k closest queried so far. Nodes which
+ * don't make it, or are pushed out, go back to the slab.
+ */
+void kad_lookup_past_insert(struct kad_lookup *lookup,
+                            struct kad_node_lookup *nl)
+{
+    if (!nl)
+        return;
+
+    size_t i = lookup->past_len;
+    for (; i > 0; --i)
+        if (kad_distance_cmp(&lookup->target, &lookup->past[i-1]->id,
+                             &nl->id) <= 0)
+            break;
+    if (i == KAD_K_CONST) {
+        kad_lookup_node_free(lookup, nl);
+        return;
+    }
+
+    if (lookup->past_len == KAD_K_CONST)
+        kad_lookup_node_free(lookup, lookup->past[--lookup->past_len]);
+    memmove(&lookup->past[i+1], &lookup->past[i],
+            (lookup->past_len - i) * sizeof(*lookup->past));
+    lookup->past[i] = nl;
+    lookup->past_len++;
+}
+
+/**
+ * Records the response of @node after @rtt ms: the k closest responders make
+ * the lookup's result.
+ */
+void kad_lookup_responded(struct kad_lookup *lookup,
+                          const struct kad_node_info *node, int rtt)
+{
+    struct kad_lookup_result *res = &lookup->result;
+    struct kad_lookup_stats *stats = &res->stats;
+    stats->responses++;
+    lookup->rtt_sum += rtt;
+    if (stats->rtt_min == ROUTES_RTT_UNKNOWN || rtt < stats->rtt_min)
+        stats->rtt_min = rtt;
+    if (stats->rtt_max == ROUTES_RTT_UNKNOWN || rtt > stats->rtt_max)
+        stats->rtt_max = rtt;
+
+    size_t i = 0;
+    for (; i < res->nodes_len; ++i) {
+        int cmp = kad_distance_cmp(&res->target, &node->id, &res->nodes[i].id);
+        if (cmp == 0)
+            return; // already responded
+        if (cmp < 0)
+            break;
+    }
+    if (i == KAD_K_CONST)
+        return;
+
+    size_t last = res->nodes_len < KAD_K_CONST ? res->nodes_len : KAD_K_CONST - 1;
+    for (size_t j = last; j > i; --j) {
+        res->nodes[j] = res->nodes[j-1];
+        res->rtts[j] = res->rtts[j-1];
+    }
+    res->nodes[i] = *node;
+    res->rtts[i] = rtt;
+    if (res->nodes_len < KAD_K_CONST)
+        res->nodes_len++;
+}
+
+/**
+ * Completes the lookup's statistics.
+ */
+void kad_lookup_finish(struct kad_lookup *lookup, long long now)
+{
+    struct kad_lookup_stats *stats = &lookup->result.stats;
+    stats->rounds = lookup->round;
+    stats->elapsed = now - lookup->started;
+    if (stats->responses > 0)
+        stats->rtt_mean = (int)(lookup->rtt_sum / (long long)stats->responses);
+}
+
+/**
+ * Sorts @nodes and their @rtts in place by rank for @target, see
+ * kad_lookup_rank(). Meant for the few nodes of routes_find_closest(), already
+ * sorted by distance.
+ */
+void kad_lookup_rank_nodes(struct kad_node_info nodes[], int rtts[],
+                           size_t nodes_len, const kad_guid *target)
+{
+    for (size_t i = 1; i < nodes_len; ++i) {
+        struct kad_node_info node = nodes[i];
+        int rtt = rtts[i];
+        size_t j = i;
+        for (; j > 0 && kad_lookup_rank(target, &node.id, rtt,
+                                        &nodes[j-1].id, rtts[j-1]) < 0; --j) {
+            nodes[j] = nodes[j-1];
+            rtts[j] = rtts[j-1];
+        }
+        nodes[j] = node;
+        rtts[j] = rtt;
+    }
+}
+
+void kad_lookups_init(struct kad_lookups *lookups, size_t max)
+{
+    for (size_t i = 0; i < KAD_LOOKUPS_MAX; ++i)
+        kad_lookup_init(&lookups->slots[i]);
+    lookups->max = max < KAD_LOOKUPS_MAX ? max : KAD_LOOKUPS_MAX;
+    lookups->len = 0;
+    lookups->last_id = 0;
+    lookups->mode = KAD_LOOKUP_PAR_DEFAULT;
+}
+
+void kad_lookups_terminate(struct kad_lookups *lookups)
+{
+    for (size_t i = 0; i < KAD_LOOKUPS_MAX; ++i)
+        kad_lookup_terminate(&lookups->slots[i]);
+    lookups->len = 0;
+}
+
+/**
+ * Returns a fresh lookup for @target, or NULL when @lookups->max lookups are
+ * already running.
+ */
+struct kad_lookup *
+kad_lookups_new(struct kad_lookups *lookups, const kad_guid *target,
+                long long now)
+{
+    if (lookups->len >= lookups->max)
+        return NULL;
+
+    struct kad_lookup *lookup = NULL;
+    for (size_t i = 0; i < KAD_LOOKUPS_MAX && !lookup; ++i)
+        if (lookups->slots[i].id == 0)
+            lookup = &lookups->slots[i];
+    if (!lookup)
+        return NULL;
+
+    if (++lookups->last_id == 0) // wrapped
+        lookups->last_id = 1;
+    lookup->id = lookups->last_id;
+    lookup->target = *target;
+    lookup->started = now;
+    lookup->deadline = now + KAD_LOOKUP_DEADLINE_MILLIS;
+    lookup->cb = NULL;
+    lookup->cb_data = NULL;
+    lookup->result = (struct kad_lookup_result){
+        .target = *target,
+        .stats = {.rtt_min = ROUTES_RTT_UNKNOWN, .rtt_max = ROUTES_RTT_UNKNOWN,
+                  .rtt_mean = ROUTES_RTT_UNKNOWN}
+    };
+    lookup->rtt_sum = 0;
+    lookup->mode = lookups->mode;
+    lookups->len++;
+    return lookup;
+}
+
+struct kad_lookup *kad_lookups_get(struct kad_lookups *lookups, unsigned id)
+{
+    if (id == 0)
+        return NULL;
+    for (size_t i = 0; i < KAD_LOOKUPS_MAX; ++i)
+        if (lookups->slots[i].id == id)
+            return &lookups->slots[i];
+    return NULL;
+}
+
+struct kad_lookup *
+kad_lookups_find(struct kad_lookups *lookups, const kad_guid *target)
+{
+    for (size_t i = 0; i < KAD_LOOKUPS_MAX; ++i)
+        if (lookups->slots[i].id != 0 &&
+            kad_guid_eq(&lookups->slots[i].target, target))
+            return &lookups->slots[i];
+    return NULL;
+}
+
+/**
+ * Frees the slot of @lookup. Its in-flight queries are left to their own
+ * timeout, their responses being then ignored.
+ */
+void kad_lookups_end(struct kad_lookups *lookups, struct kad_lookup *lookup)
+{
+    kad_lookup_reset(lookup);
+    lookup->id = 0;
+    lookups->len--;
+}
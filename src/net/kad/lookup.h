@@ -5,25 +5,89 @@
 /**
  * State for the kad node lookup process.
  *
- * This state is accessed by 2 unsynced events: kad_lookup_recv() and
- * kad_lookup_progress().
+ * Each lookup has its own state, so that lookups for different targets run
+ * concurrently. A state is accessed by 2 unsynced events: kad_lookup_recv()
+ * and kad_lookup_next(), both finding it by id.
  *
  * See discussion in comments at the end of this file.
  */
+#include "net/kad/distance.h"
 #include "net/kad/routes.h"
 #include "utils/heap.h"
+#include "utils/lookup.h"
+#include "utils/slab.h"
+
+#define KAD_LOOKUP_SLAB_LEN 32
+#define KAD_LOOKUPS_MAX 16
+#define KAD_LOOKUPS_DEFAULT 8
+#define KAD_LOOKUP_DEADLINE_MILLIS 30000
+// Power of 2, whose 3/4 hold the next heap, the k past and the k in flight.
+#define KAD_LOOKUP_SEEN_SIZE 256
+#define KAD_LOOKUP_PAR_DEFAULT KAD_LOOKUP_PAR_STRICT
+
+/**
+ * Parallelism modes, see discussion at the end of this file.
+ */
+enum kad_lookup_par {
+    KAD_LOOKUP_PAR_NONE,
+    KAD_LOOKUP_PAR_STRICT,  // iterate when all queries returned or timed out
+    KAD_LOOKUP_PAR_BOUNDED, // α in flight, a new query per response
+    KAD_LOOKUP_PAR_LOOSE,   // iterate per response, and widen on timeout
+};
+
+static const lookup_entry kad_lookup_par_names[] = {
+    { KAD_LOOKUP_PAR_STRICT,  "strict" },
+    { KAD_LOOKUP_PAR_BOUNDED, "bounded" },
+    { KAD_LOOKUP_PAR_LOOSE,   "loose" },
+    { 0,                      NULL },
+};
 
 struct kad_node_lookup {
-    kad_guid                target;
-    kad_guid                id;
-    struct sockaddr_storage addr;
+    kad_guid            target;
+    kad_guid            id;
+    struct compact_addr addr;
+    int                 rtt; // ms, or ROUTES_RTT_UNKNOWN
 };
 
 /**
- * Compares the distance of 2 nodes to a given target.
+ * Compares 2 RTTs, unknown ones being the largest.
+ */
+static inline int kad_rtt_cmp(int a, int b)
+{
+    if (a == b)
+        return 0;
+    if (a == ROUTES_RTT_UNKNOWN)
+        return 1;
+    if (b == ROUTES_RTT_UNKNOWN)
+        return -1;
+    return a < b ? -1 : 1;
+}
+
+/**
+ * Ranks 2 lookup candidates: the closest to @target first. Candidates as
+ * close as each other, that is whose distances to @target have the same
+ * highest bit, are ranked by RTT: lower-latency hops make faster lookups.
  *
- * Returns a negative number if a > b, 0 if a == b, a positive int if
- * a < b. Intended for min-heap.
+ * Returns a negative number if @a ranks first, 0 if a == b, a positive int if
+ * @b ranks first.
+ */
+static inline int kad_lookup_rank(const kad_guid *target,
+                                  const kad_guid *a, int a_rtt,
+                                  const kad_guid *b, int b_rtt)
+{
+    int a_lz = kad_distance_clz(target, a);
+    int b_lz = kad_distance_clz(target, b);
+    if (a_lz != b_lz)
+        return b_lz - a_lz;
+    int cmp = kad_rtt_cmp(a_rtt, b_rtt);
+    return cmp ? cmp : kad_distance_cmp(target, a, b);
+}
+
+/**
+ * Ranks 2 nodes for a given target, see kad_lookup_rank().
+ *
+ * Returns a negative number if b ranks first, 0 if a == b, a positive int if
+ * a ranks first. Intended for min-heap.
  */
 static inline
 int node_heap_cmp(const struct kad_node_lookup *a,
@@ -32,28 +96,106 @@ int node_heap_cmp(const struct kad_node_lookup *a,
     if (memcmp(&a->target, &b->target, KAD_GUID_SPACE_IN_BYTES) != 0)
         return INT_MIN; // convention
 
-    size_t i = 0;
-    unsigned char xa, xb;
-    while (i < KAD_GUID_SPACE_IN_BYTES) {
-        // avoid kad_guid_xor()
-        xa = a->id.bytes[i] ^ a->target.bytes[i];
-        xb = b->id.bytes[i] ^ b->target.bytes[i];
-        if (xa != xb)
-            break;
-        i++;
+    return kad_lookup_rank(&a->target, &b->id, b->rtt, &a->id, a->rtt);
+}
+
+/**
+ * Ids a lookup came across, so that it queries each node once at most.
+ *
+ * Open addressing with linear probing, at most 3/4 full: ids past that are
+ * taken as unseen, as skipping them could stall the lookup.
+ */
+struct kad_seen {
+    kad_guid ids[KAD_LOOKUP_SEEN_SIZE]; // free when !is_set
+    size_t   len;
+};
+
+/**
+ * Adds @id to @seen. Returns false if @id was already seen; true otherwise,
+ * including when @seen is full and @id isn't kept.
+ */
+static inline bool kad_seen_add(struct kad_seen *seen, const kad_guid *id)
+{
+    size_t i = kad_id_hash(id) & (KAD_LOOKUP_SEEN_SIZE - 1);
+    while (seen->ids[i].is_set) {
+        if (kad_guid_eq(&seen->ids[i], id))
+            return false;
+        i = (i + 1) & (KAD_LOOKUP_SEEN_SIZE - 1);
     }
-    return i == KAD_GUID_SPACE_IN_BYTES ? 0 : xb - xa;
+    if (seen->len >= KAD_LOOKUP_SEEN_SIZE / 4 * 3)
+        return true;
+    seen->ids[i] = *id;
+    seen->len++;
+    return true;
 }
 
+SLAB_GENERATE(node_lookup_slab, struct kad_node_lookup, KAD_LOOKUP_SLAB_LEN)
+
 // cppcheck-suppress ctunullpointer
 HEAP_GENERATE(node_heap, struct kad_node_lookup *, 128 /* arbitray limit can be adapted */)
 
+struct kad_lookup_stats {
+    int       rounds;    // iterations
+    size_t    queries;   // find_node sent
+    size_t    responses;
+    int       rtt_min;   // ms, of responses, or ROUTES_RTT_UNKNOWN
+    int       rtt_max;
+    int       rtt_mean;
+    long long elapsed;   // ms, from start to completion
+};
+
+/**
+ * Outcome of a lookup, handed to its completion callback.
+ */
+struct kad_lookup_result {
+    kad_guid                target;
+    struct kad_node_info    nodes[KAD_K_CONST]; // closest responders first
+    int                     rtts[KAD_K_CONST];  // ms, of their responses
+    size_t                  nodes_len;
+    struct kad_lookup_stats stats;
+};
+
+/**
+ * Called once when a lookup completes, from the event loop. @result is only
+ * valid during the call.
+ */
+typedef void (*kad_lookup_cb)(const struct kad_lookup_result *result, void *data);
+
 struct kad_lookup {
+    unsigned              id;       // 0 when idle
+    kad_guid              target;
+    long long             started;
+    long long             deadline; // given up afterwards
+    kad_lookup_cb         cb;       // optional
+    void                 *cb_data;
+    struct kad_lookup_result result;
+    long long             rtt_sum;
+    enum kad_lookup_par   mode;
     int                   round;
     struct kad_rpc_query *par[KAD_K_CONST]; // parallel aka in-flight
-    size_t                par_len;
+    size_t                par_len;  // in-flight cap
+    size_t                sched;    // find_node scheduled, not sent yet
     struct node_heap      next;
-    struct node_heap      past;
+    // The k closest nodes queried so far, closest first.
+    struct kad_node_lookup *past[KAD_K_CONST];
+    size_t                past_len;
+    struct kad_seen       seen;
+    // Nodes of next and past, given back all at once on reset.
+    struct node_lookup_slab nodes;
+};
+
+/**
+ * Table of running lookups.
+ *
+ * Lookup ids are never reused, so that events and responses outliving their
+ * lookup are simply ignored: kad_lookups_get() doesn't find it anymore.
+ */
+struct kad_lookups {
+    struct kad_lookup slots[KAD_LOOKUPS_MAX];
+    size_t            max;     // concurrent lookups cap, <= KAD_LOOKUPS_MAX
+    size_t            len;
+    unsigned          last_id;
+    enum kad_lookup_par mode;  // of new lookups
 };
 
 void kad_lookup_init(struct kad_lookup *lookup);
@@ -62,7 +204,22 @@ void kad_lookup_reset(struct kad_lookup *lookup);
 bool kad_lookup_par_is_empty(const struct kad_lookup *lookup);
 bool kad_lookup_par_add(struct kad_lookup *lookup, struct kad_rpc_query *query);
 bool kad_lookup_par_remove(struct kad_lookup *lookup, const struct kad_rpc_query *query);
-struct kad_node_lookup *kad_lookup_new_from(const struct kad_node_info *info, const kad_guid target);
+size_t kad_lookup_par_free(const struct kad_lookup *lookup);
+bool kad_lookup_iterate(struct kad_lookup *lookup);
+bool kad_lookup_converged(const struct kad_lookup *lookup);
+struct kad_node_lookup *kad_lookup_new_from(struct kad_lookup *lookup, const struct kad_node_info *info, const kad_guid target, int rtt);
+void kad_lookup_rank_nodes(struct kad_node_info nodes[], int rtts[], size_t nodes_len, const kad_guid *target);
+void kad_lookup_node_free(struct kad_lookup *lookup, struct kad_node_lookup *nl);
+void kad_lookup_past_insert(struct kad_lookup *lookup, struct kad_node_lookup *nl);
+void kad_lookup_responded(struct kad_lookup *lookup, const struct kad_node_info *node, int rtt);
+void kad_lookup_finish(struct kad_lookup *lookup, long long now);
+
+void kad_lookups_init(struct kad_lookups *lookups, size_t max);
+void kad_lookups_terminate(struct kad_lookups *lookups);
+struct kad_lookup *kad_lookups_new(struct kad_lookups *lookups, const kad_guid *target, long long now);
+struct kad_lookup *kad_lookups_get(struct kad_lookups *lookups, unsigned id);
+struct kad_lookup *kad_lookups_find(struct kad_lookups *lookups, const kad_guid *target);
+void kad_lookups_end(struct kad_lookups *lookups, struct kad_lookup *lookup);
 
 
 /*
@@ -163,10 +320,23 @@ struct kad_node_lookup *kad_lookup_new_from(const struct kad_node_info *info, co
   queries. When a request times out, remove it from in_flight and request
   lists.
 
-  - we will limit running lookup processes to 1, simply by checking lookup
-  round. Other lookup processes, like triggered by refresh, must be delayed.
+  - lookup processes run concurrently, each with its own state, up to a
+  configurable cap (`struct kad_lookups`). Queries carry the id of the lookup
+  which spawned them, so that responses progress the right one. A target
+  already being looked up isn't looked up twice.
+
+  - lookups run with one of 3 parallelism modes (`enum kad_lookup_par`, see
+  notes below), chosen for new lookups (`kad_lookups.mode`). Strict: α queries,
+  the round ends when all returned or timed out, then α or k nodes are queried
+  whether the round brought closer nodes. Bounded: a new query per response,
+  α in flight at most. Loose: a new query per response, and on a round
+  timeout, α more queries without discarding pending ones, up to k in flight.
+  `tests/bench/lookup_modes.c` compares them on a simulated network.
 
-  - when lookup round >= k: stop timer; reset lookup round; reset lookup list.
+  - when the k closest nodes seen all responded (none queued or in flight is
+  closer, kad_lookup_converged()), when no node is left to query and none is
+  in flight, or past the lookup deadline: reset lookup list; free the lookup
+  slot.
 
   Q: How do we implement node lookups - part 2 ?
 
@@ -224,8 +394,9 @@ struct kad_node_lookup *kad_lookup_new_from(const struct kad_node_info *info, co
   iteration if we find closer nodes.
 
   About the first α nodes we select from our buckets: buckets are ordered
-  oldest first. FIXME we should sort all k nodes by distance to target and then
-  take the first α ones.
+  oldest first. We sort all k nodes by distance to target, and take the first
+  α ones, preferring faster nodes among equally close ones (see
+  kad_lookup_rank()).
 
 
   NOTES AND REFERENCES:
@@ -15,6 +15,9 @@
  * We need fast access (=> hash by tx_id), fixed-sized for safety, and
  * expiration (=> FIFO linked-list). This is very similar to a LRU cache except
  * we don't refresh on lookup.
+ *
+ * Eviction is only a safety net: each query arms its own timeout timer, which
+ * removes it after KAD_RPC_QUERY_TIMEOUT_MILLIS.
  */
 #define REQ_LRU_CAPACITY 1024
 
@@ -71,6 +74,7 @@ req_lru_put(struct req_lru *lru, struct kad_rpc_query *q,
         list_delete(last);
         struct kad_rpc_query *evict = cont(last, struct kad_rpc_query, litem);
         hash_delete(&evict->hitem);
+        lru->len--;
         if (evicted)
             *evicted = evict;
     }
@@ -13,12 +13,14 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include "config.h"
 #include "log.h"
 #include "file.h"
 #include "utils/cont.h"
 #include "utils/helpers.h"
 #include "utils/safer.h"
 #include "net/kad/bencode/routes.h"
+#include "net/kad/distance.h"
 #include "net/kad/routes.h"
 
 #define ROUTES_STATE_LEN_IN_BYTES 4096
@@ -42,16 +44,38 @@ static void kad_generate_id(kad_guid *uid)
     kad_guid_set(uid, rand);
 }
 
+static struct kad_bucket *kad_bucket_new()
+{
+    struct kad_bucket *bucket = malloc(sizeof(struct kad_bucket));
+    if (!bucket) {
+        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+        return NULL;
+    }
+    bucket->len = 0;
+    return bucket;
+}
+
 static void routes_init(struct kad_routes *routes)
 {
     memset(&routes->self_id, 0, sizeof(kad_guid));
     for (size_t i = 0; i < KAD_GUID_SPACE_IN_BITS; i++) {
-        list_init(&routes->buckets[i]);
+        routes->buckets[i] = NULL;
         list_init(&routes->replacements[i]);
+        routes->replacements_len[i] = 0;
     }
+    hash_init(routes->index, ROUTES_INDEX_SIZE);
+    kad_node_slab_init(&routes->nodes);
+    routes->replacements_max = ROUTES_REPLACEMENTS_MAX;
+    routes->stale_max = ROUTES_STALE_MAX;
+    routes->promoted = 0;
+    routes->dropped = 0;
 }
 
-static struct kad_routes *routes_new()
+/**
+ * With @split, starts with a single bucket, split on demand. Otherwise
+ * allocates all buckets.
+ */
+static struct kad_routes *routes_new(bool split)
 {
     struct kad_routes *routes = malloc(sizeof(struct kad_routes));
     if (!routes) {
@@ -59,13 +83,21 @@ static struct kad_routes *routes_new()
         return NULL;
     }
     routes_init(routes);
+
+    routes->self_bucket = split ? KAD_GUID_SPACE_IN_BITS - 1 : 0;
+    for (int i = routes->self_bucket; i < KAD_GUID_SPACE_IN_BITS; i++) {
+        if (!(routes->buckets[i] = kad_bucket_new())) {
+            routes_destroy(routes);
+            return NULL;
+        }
+    }
     return routes;
 }
 
 struct kad_routes *routes_create()
 {
     struct kad_routes *routes = NULL;
-    if ((routes = routes_new()) == NULL)
+    if ((routes = routes_new(ROUTES_SPLIT_DEFAULT)) == NULL)
         return NULL;
 
     /* « Node IDs are currently just random 160-bit identifiers, though they
@@ -80,12 +112,9 @@ struct kad_routes *routes_create()
 
 void routes_destroy(struct kad_routes *routes)
 {
-    for (int i = 0; i < KAD_GUID_SPACE_IN_BITS; i++) {
-        struct list_item *bucket = &routes->buckets[i];
-        list_free_all(bucket, struct kad_node, item);
-        bucket = &routes->replacements[i];
-        list_free_all(bucket, struct kad_node, item);
-    }
+    for (int i = 0; i < KAD_GUID_SPACE_IN_BITS; i++)
+        free_safer(routes->buckets[i]);
+    kad_node_slab_release(&routes->nodes);
     free_safer(routes);
 }
 
@@ -110,7 +139,7 @@ void routes_destroy(struct kad_routes *routes)
  *
  * Note in practice we don't need to actually compute the integer value of the
  * kad distance, which wouldn't fit into any C integer type, just compare
- * distances. See node_heap_cmp().
+ * distances. See kad_distance_cmp().
  */
 static inline int kad_bucket_hash(const kad_guid *self_id,
                                   const kad_guid *remote_id)
@@ -118,19 +147,9 @@ static inline int kad_bucket_hash(const kad_guid *self_id,
     if (!self_id || !remote_id || !self_id->is_set || !remote_id->is_set)
         return -1;
 
-    int diff = KAD_GUID_SPACE_IN_BITS;
-    for (size_t i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i) {
-        // avoid additional kad_guid_xor()
-        unsigned char xor = self_id->bytes[i] ^ remote_id->bytes[i];
-        unsigned lz = clz(xor);
-        diff -= lz;
-        if (lz != CHAR_BIT ||
-            diff == 0) // in case guid space in bytes and in bits are not
-                       // consistent, like when testing
-            break;
-    }
-
-    return diff > 0 ? diff - 1 : 0;
+    // Bits past KAD_GUID_SPACE_IN_BITS, like when testing, don't count.
+    int lz = kad_distance_clz(self_id, remote_id);
+    return lz < KAD_GUID_SPACE_IN_BITS ? KAD_GUID_SPACE_IN_BITS - 1 - lz : 0;
 }
 
 /**
@@ -138,51 +157,119 @@ static inline int kad_bucket_hash(const kad_guid *self_id,
  * @nodes_pos, excluding @caller.
  */
 static inline size_t
-kad_bucket_get_nodes(const struct list_item *bucket,
+kad_bucket_get_nodes(const struct kad_bucket *bucket,
                      struct kad_node_info nodes[],
                      size_t start, size_t stop,
                      const kad_guid *caller)
 {
-    const struct list_item *it = bucket;
-    struct kad_node *node;
     size_t bucket_pos = 0;
-    list_for(it, bucket) {
+    for (size_t i = 0; i < bucket->len; ++i) {
         if (bucket_pos >= stop)
             break;
-        node = cont(it, struct kad_node, item);
-        if (kad_guid_eq(&node->info.id, caller)) {
+        if (kad_guid_eq(&bucket->ids[i], caller)) {
             log_debug("%s: ignoring known caller", __func__);
             continue;
         }
-        BYTE_ARRAY_COPY(nodes[start+bucket_pos], node->info);
+        BYTE_ARRAY_COPY(nodes[start+bucket_pos], bucket->nodes[i].info);
         bucket_pos += 1;
     }
     return bucket_pos;
 }
 
-#include "utils/heap.h"
-
 struct candidate {
     struct kad_node_info node;
     kad_guid             dist;
 };
 
-static int candidate_heap_cmp(const struct candidate *a, const struct candidate *b) {
-    return BYTE_ARRAY_CMP(&a->dist, &b->dist, KAD_GUID_SPACE_IN_BYTES);
+static int candidate_cmp(const struct candidate *a, const struct candidate *b) {
+    return kad_id_cmp(&a->dist, &b->dist);
+}
+
+/**
+ * Returns bit @i of @id, counted from the least significant bit of the id
+ * space, like bucket indexes.
+ */
+static inline bool kad_guid_bit(const kad_guid *id, int i)
+{
+    int pos = KAD_GUID_SPACE_IN_BITS - 1 - i;
+    return id->bytes[pos / CHAR_BIT] & (0x80 >> (pos % CHAR_BIT));
+}
+
+/**
+ * Fills @order with all bucket indexes, by ascending xor distance of their
+ * nodes to @target.
+ *
+ * Nodes of bucket i share the self id's prefix up to bit i, which they
+ * differ on. For b the bucket of @target, and d = target ^ self:
+ *  - bucket b holds the nodes sharing the longest prefix with @target;
+ *  - buckets i < b, where d_i is 1, next by descending i, as their distance
+ *    to @target is < 2^(i+1), given bit i matches @target;
+ *  - buckets i < b, where d_i is 0, by ascending i, as their distance to
+ *    @target is in [2^i, 2^(i+1));
+ *  - buckets i > b, by ascending i, as bit i of their distance is set.
+ * The distance intervals of buckets are thus disjoint and ordered.
+ */
+static void routes_bucket_order(const kad_guid *self_id, const kad_guid *target,
+                                int order[KAD_GUID_SPACE_IN_BITS])
+{
+    kad_guid dist;
+    kad_distance(&dist, self_id, target);
+    int b = kad_bucket_hash(self_id, target);
+    if (b < 0)
+        b = 0;
+
+    size_t n = 0;
+    order[n++] = b;
+    for (int i = b - 1; i >= 0; --i)
+        if (kad_guid_bit(&dist, i))
+            order[n++] = i;
+    for (int i = 0; i < b; ++i)
+        if (!kad_guid_bit(&dist, i))
+            order[n++] = i;
+    for (int i = b + 1; i < KAD_GUID_SPACE_IN_BITS; ++i)
+        order[n++] = i;
+}
+
+/**
+ * Like routes_bucket_order(), for buckets actually allocated: self's bucket
+ * takes the place of the first bucket it covers. The order still holds, as
+ * the distance interval of self's bucket is the union of the intervals of
+ * the buckets it covers, which are contiguous in the order. Returns the
+ * number of buckets.
+ */
+static size_t routes_bucket_order_split(const struct kad_routes *routes,
+                                        const kad_guid *target,
+                                        int order[KAD_GUID_SPACE_IN_BITS])
+{
+    int all[KAD_GUID_SPACE_IN_BITS];
+    routes_bucket_order(&routes->self_id, target, all);
+
+    size_t n = 0;
+    bool self_seen = false;
+    for (int o = 0; o < KAD_GUID_SPACE_IN_BITS; ++o) {
+        if (all[o] > routes->self_bucket)
+            order[n++] = all[o];
+        else if (!self_seen) {
+            order[n++] = routes->self_bucket;
+            self_seen = true;
+        }
+    }
+    return n;
 }
-HEAP_GENERATE(candidate_heap, struct candidate*, KAD_K_CONST+1) // cppcheck-suppress ctunullpointer
-HEAP_GENERATE_REPLACE_TOP(candidate_heap, struct candidate*)
 
 /**
  * Fills the given @nodes array with k nodes closest to the @target node,
- * ignoring the @caller node if known.
+ * ignoring the @caller node if known, by ascending distance.
  *
  * Returns number of nodes found.
  *
  * @nodes MUST be of length KAD_K_CONST.
  *
  * Traverses the routing table in xor distance ascending order relative to the
- * target key. http://stackoverflow.com/a/30655403/421846
+ * target key, bucket by bucket, and stops as soon as k nodes are collected:
+ * as bucket distance intervals don't overlap, nodes of unvisited buckets
+ * can't be closer. Only the visited buckets' nodes are sorted.
+ * http://stackoverflow.com/a/30655403/421846
  */
 size_t routes_find_closest(struct kad_routes *routes, struct kad_node_info nodes[],
                            const kad_guid *target, const kad_guid *caller) {
@@ -199,126 +286,194 @@ size_t routes_find_closest(struct kad_routes *routes, struct kad_node_info nodes
         return nodes_len;
     }
 
-    // k+1 to exclude caller afterwards
-    struct candidate candidates[KAD_K_CONST+1] = {0};
-    struct candidate *c = candidates;
+    int order[KAD_GUID_SPACE_IN_BITS];
+    size_t order_len = routes_bucket_order_split(routes, target, order);
+
+    // The last visited bucket may overshoot k by a bucket's length.
+    struct candidate candidates[2*KAD_K_CONST];
+    size_t len = 0;
+    for (size_t o = 0; o < order_len && len < KAD_K_CONST; ++o) {
+        const struct kad_bucket *bucket = routes->buckets[order[o]];
+        for (size_t j = 0; j < bucket->len; ++j) {
+            if (kad_guid_eq(caller, &bucket->ids[j])) {
+                log_debug("%s: ignoring known caller", __func__);
+                continue;
+            }
+            struct candidate *c = &candidates[len++];
+            kad_distance(&c->dist, &bucket->ids[j], target);
+            c->node = bucket->nodes[j].info;
+        }
+    }
 
-    struct candidate_heap sorted = {0};
-    candidate_heap_init(&sorted, KAD_K_CONST+1);
+    // Insertion sort, as there are at most 2k candidates.
+    for (size_t i = 1; i < len; ++i) {
+        struct candidate tmp = candidates[i];
+        size_t j = i;
+        for (; j > 0 && candidate_cmp(&tmp, &candidates[j-1]) < 0; --j)
+            candidates[j] = candidates[j-1];
+        candidates[j] = tmp;
+    }
 
-    // traverse routes
-    for (int i = 0; i < KAD_GUID_SPACE_IN_BITS; ++i) {
-        struct list_item *bucket = &routes->buckets[i];
+    nodes_len = len < KAD_K_CONST ? len : KAD_K_CONST;
+    for (size_t i = 0; i < nodes_len; ++i)
+        BYTE_ARRAY_COPY(nodes[i], candidates[i].node);
 
-        struct list_item *it = bucket;
-        list_for(it, bucket) {
-            struct kad_node *node = cont(it, struct kad_node, item);
-            /* log_debug("__i=%d, j=%d, bucket len=%d", i, j, list_count(it)); */
+    return nodes_len;
+}
 
-            struct candidate tmp = {0};
-            tmp.node = node->info; // cppcheck-suppress nullPointer
-            kad_guid_xor(&tmp.dist, &node->info.id, target);
 
-            /* LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES); */
-            /* log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, tmp.node.id.bytes); */
-            /* LOG_FMT_HEX_DECL(dist, KAD_GUID_SPACE_IN_BYTES); */
-            /* log_fmt_hex(dist, KAD_GUID_SPACE_IN_BYTES, tmp.dist.bytes); */
-            /* log_debug("__tmp=%d, id=%s, dist=%s", nodes_len, id, dist); */
+/** Returns the position of @node_id in @bucket, or -1. */
+static inline int kad_bucket_find(const struct kad_bucket *bucket,
+                                  const kad_guid *node_id)
+{
+    for (size_t i = 0; i < bucket->len; ++i)
+        if (kad_guid_eq(&bucket->ids[i], node_id))
+            return i;
+    return -1;
+}
 
-            /* log_debug("__sorted.len=%d, K=%d", sorted.len, KAD_K_CONST+1); */
-            if (sorted.len < KAD_K_CONST+1) {
-                *c = tmp;
-                candidate_heap_push(&sorted, c);
-                c++;
-            }
-            else {
-                struct candidate *max = HEAP_PEEK(sorted);
-                // better than worst (of the best candidates) or watermark
-                if (candidate_heap_cmp(&tmp, max) < 0) {
-                    c = max;
-                    *c = tmp;
-                    candidate_heap_replace_top(&sorted, c);
-                }
-            }
-        }
-    }
+static inline void kad_bucket_append(struct kad_bucket *bucket,
+                                     const struct kad_node *node)
+{
+    bucket->ids[bucket->len] = node->info.id;
+    bucket->nodes[bucket->len] = *node;
+    bucket->len++;
+}
 
-    // Looping over heap_pop() rather than candidates (faster) since order matters.
-    while ((c = candidate_heap_pop(&sorted))) {
-        if (kad_guid_eq(caller, &c->node.id)) {
-            log_debug("%s: ignoring known caller", __func__);
-            continue;
-        }
+static inline void kad_bucket_remove(struct kad_bucket *bucket, size_t pos)
+{
+    size_t tail = bucket->len - pos - 1;
+    memmove(&bucket->ids[pos], &bucket->ids[pos+1], tail * sizeof(kad_guid));
+    memmove(&bucket->nodes[pos], &bucket->nodes[pos+1],
+            tail * sizeof(struct kad_node));
+    bucket->len--;
+}
 
-        /* LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES); */
-        /* log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, c->node.id.bytes); */
-        /* LOG_FMT_HEX_DECL(dist, KAD_GUID_SPACE_IN_BYTES); */
-        /* log_fmt_hex(dist, KAD_GUID_SPACE_IN_BYTES, c->dist.bytes); */
-        /* log_debug("__node=%d, id=%s, dist=%s", nodes_len, id, dist); */
+/** Inserts @node before the first node seen more recently. */
+static inline void kad_bucket_insert_seen(struct kad_bucket *bucket,
+                                          const struct kad_node *node)
+{
+    size_t pos = bucket->len;
+    while (pos > 0 && bucket->nodes[pos-1].last_seen > node->last_seen)
+        pos--;
+    size_t tail = bucket->len - pos;
+    memmove(&bucket->ids[pos+1], &bucket->ids[pos], tail * sizeof(kad_guid));
+    memmove(&bucket->nodes[pos+1], &bucket->nodes[pos],
+            tail * sizeof(struct kad_node));
+    bucket->ids[pos] = node->info.id;
+    bucket->nodes[pos] = *node;
+    bucket->len++;
+}
 
-        if  (nodes_len < KAD_K_CONST) {
-            BYTE_ARRAY_COPY(nodes[nodes_len], c->node);
-            nodes_len++;
-        }
-        else {
-            BYTE_ARRAY_COPY(nodes[0], c->node);
-        }
-    }
+/** Moves node at @pos to the tail, as the most recently seen. */
+static inline void kad_bucket_touch(struct kad_bucket *bucket, size_t pos)
+{
+    if (pos == bucket->len - 1)
+        return;
+    struct kad_node node = bucket->nodes[pos];
+    kad_bucket_remove(bucket, pos);
+    kad_bucket_append(bucket, &node);
+}
 
-    candidate_heap_reset(&sorted);
+static inline uint32_t routes_index_hash(const kad_guid id)
+{
+    return kad_id_hash(&id);
+}
 
-    return nodes_len;
+static inline int routes_index_cmp(const kad_guid a, const kad_guid b)
+{
+    return kad_id_cmp(&a, &b);
 }
 
+HASH_GENERATE(routes_index, kad_node, index, info.id, kad_guid, ROUTES_INDEX_SIZE)
 
-/** Count bucket length.  */
-static inline size_t kad_bucket_count(const struct list_item *bucket)
+/**
+ * Returns the index of the bucket of @node_id, or -1: buckets below self's
+ * bucket are merged into it.
+ */
+static inline int routes_bucket_idx(const struct kad_routes *routes,
+                                    const kad_guid *node_id)
 {
-    size_t count = 0;
-    const struct list_item *it = bucket;
-    list_for(it, bucket)
-        count++;
-    return count;
+    int bkt_idx = kad_bucket_hash(&routes->self_id, node_id);
+    if (bkt_idx >= 0 && bkt_idx < routes->self_bucket)
+        bkt_idx = routes->self_bucket;
+    return bkt_idx;
 }
 
-/** Get node with @node_id from list (bucket) @list. */
-static inline struct kad_node*
-routes_get_from_list(const struct list_item *list, const kad_guid *node_id)
+/**
+ * Splits self's bucket in 2: nodes sharing a longer prefix with self move to
+ * a new self's bucket, the others stay. Orders are preserved.
+ */
+static bool routes_split(struct kad_routes *routes)
 {
-    const struct list_item *it = list;
-    struct kad_node *found;
-    list_for(it, list) {
-        found = cont(it, struct kad_node, item);
-        if (kad_guid_eq(&found->info.id, node_id))
-            return found;
+    int far_idx = routes->self_bucket;
+    struct kad_bucket *near = kad_bucket_new();
+    if (!near)
+        return false;
+
+    struct kad_bucket *far = routes->buckets[far_idx];
+    for (size_t i = 0; i < far->len;) {
+        if (kad_bucket_hash(&routes->self_id, &far->ids[i]) < far_idx) {
+            kad_bucket_append(near, &far->nodes[i]);
+            kad_bucket_remove(far, i);
+        }
+        else
+            i++;
     }
-    return NULL;
+    routes->buckets[far_idx - 1] = near;
+    routes->self_bucket = far_idx - 1;
+    log_debug("Routes split bucket %d (%zu nodes moved).", far_idx, near->len);
+    return true;
 }
 
 /**
- * Get node with @node_id from route table @routes. Also set its bucket and
- * bucket index.
+ * Get node with @node_id from route table @routes, either from its bucket or
+ * its replacement list. Also set its bucket index, and @in_bucket if found.
  */
 static struct kad_node*
-routes_get_with_bucket(struct kad_routes *routes, const kad_guid *node_id,
-                       struct list_item **bucket, size_t *bucket_idx)
+routes_get(struct kad_routes *routes, const kad_guid *node_id,
+           size_t *bucket_idx, bool *in_bucket)
 {
-    int bkt_idx = kad_bucket_hash(&routes->self_id, node_id);
+    int bkt_idx = routes_bucket_idx(routes, node_id);
     if (bucket_idx)
         *bucket_idx = bkt_idx;
+    if (bkt_idx < 0)
+        return NULL;
 
-    struct list_item *bkt = &routes->buckets[bkt_idx];
-    struct kad_node *node = routes_get_from_list(bkt, node_id);
+    struct kad_bucket *bucket = routes->buckets[bkt_idx];
+    int pos = kad_bucket_find(bucket, node_id);
+    if (in_bucket)
+        *in_bucket = pos >= 0;
+    if (pos >= 0)
+        return &bucket->nodes[pos];
 
-    if (!node) {
-        bkt = &routes->replacements[bkt_idx];
-        node = routes_get_from_list(bkt, node_id);
-    }
+    return routes_index_get(routes->index, *node_id);
+}
 
-    if (bucket)
-        *bucket = bkt;
+static void routes_replacement_remove(struct kad_routes *routes,
+                                      size_t bkt_idx, struct kad_node *node)
+{
+    hash_delete(&node->index);
+    list_delete(&node->item);
+    routes->replacements_len[bkt_idx]--;
+}
 
-    return node;
+/**
+ * Moves the most recently seen replacement node of bucket @bkt_idx, if any,
+ * into its bucket, which MUST not be full.
+ */
+static void routes_promote(struct kad_routes *routes, size_t bkt_idx)
+{
+    struct list_item *replacements = &routes->replacements[bkt_idx];
+    if (list_is_empty(replacements))
+        return;
+
+    struct kad_node *node = cont(replacements->next, struct kad_node, item);
+    routes_replacement_remove(routes, bkt_idx, node);
+    kad_bucket_insert_seen(routes->buckets[bkt_idx], node);
+    kad_node_slab_put(&routes->nodes, node);
+    routes->promoted++;
+    log_debug("Routes promoted replacement into bucket %zu.", bkt_idx);
 }
 
 /**
@@ -340,41 +495,52 @@ routes_get_with_bucket(struct kad_routes *routes, const kad_guid *node_id,
  */
 static bool routes_update(struct kad_routes *routes, const struct kad_node_info *info, time_t time)
 {
-    struct list_item *bucket = NULL;
-    struct kad_node *node = routes_get_with_bucket(routes, &info->id, &bucket, NULL);
+    size_t bkt_idx = 0;
+    bool in_bucket = false;
+    struct kad_node *node = routes_get(routes, &info->id, &bkt_idx, &in_bucket);
     if (!node)
         return false;
 
-    if (!sockaddr_storage_eq_addr(&node->info.addr, &info->addr)) {
+    if (!compact_addr_eq_ip(&node->info.addr, &info->addr)) {
         LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES);
         log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, info->id.bytes);
-        log_warning("Node (%s) changed addr: %s -> %s.", id, node->info.addr_str, info->addr_str);
+        ADDR_STR_DECL(from);
+        ADDR_STR_DECL(to);
+        log_warning("Node (%s) changed addr: %s -> %s.", id,
+                    compact_addr_fmt_log(from, &node->info.addr, LOG_WARNING),
+                    compact_addr_fmt_log(to, &info->addr, LOG_WARNING));
 
         node->info.addr = info->addr;
-        strcpy(node->info.addr_str, info->addr_str);
     }
     node->last_seen = time;
     node->stale = 0;
 
-    list_delete(&node->item);
-    list_append(bucket, &node->item);
+    if (in_bucket) {
+        struct kad_bucket *bucket = routes->buckets[bkt_idx];
+        kad_bucket_touch(bucket, node - bucket->nodes);
+    }
+    else {
+        list_delete(&node->item);
+        list_prepend(&routes->replacements[bkt_idx], &node->item);
+    }
 
     return true;
 }
 
 static struct kad_node *
-routes_node_new(const struct kad_node_info *info, time_t time)
+routes_node_new(struct kad_routes *routes, const struct kad_node_info *info,
+                time_t time)
 {
-    struct kad_node *node = malloc(sizeof(struct kad_node));
-    if (!node) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+    struct kad_node *node = kad_node_slab_get(&routes->nodes);
+    if (!node)
         return NULL;
-    }
     memset(node, 0, sizeof(struct kad_node));
 
     list_init(&node->item);
+    list_init(&node->index);
     node->info = *info;
     node->last_seen = time;
+    node->rtt = ROUTES_RTT_UNKNOWN;
 
     return node;
 }
@@ -390,24 +556,45 @@ bool routes_insert(struct kad_routes *routes, const struct kad_node_info *info,
     }
 
     size_t bkt_idx = 0;
-    struct kad_node *node = routes_get_with_bucket(routes, &info->id, NULL, &bkt_idx);
+    struct kad_node *node = routes_get(routes, &info->id, &bkt_idx, NULL);
     if (node) {
         log_warning("Routes insert failed: existing node.");
         return false;
     }
 
-    if (!(node = routes_node_new(info, time)))
-        return false;
-
-    struct list_item *bucket = &routes->buckets[bkt_idx];
-    if (kad_bucket_count(bucket) < KAD_K_CONST) {
-        list_append(bucket, &node->item);
+    struct kad_bucket *bucket = routes->buckets[bkt_idx];
+    // « When the bucket is full [...] If the bucket's range includes our own
+    // node ID, it is split into two new buckets with half the range of the
+    // old bucket » (BEP 5)
+    while (bucket->len >= KAD_K_CONST && (int)bkt_idx == routes->self_bucket &&
+           routes->self_bucket > 0) {
+        if (!routes_split(routes))
+            return false;
+        bkt_idx = routes_bucket_idx(routes, &info->id);
+        bucket = routes->buckets[bkt_idx];
+    }
+    if (bucket->len < KAD_K_CONST) {
+        kad_bucket_append(bucket, &(struct kad_node){
+                .info=*info, .last_seen=time, .stale=0,
+                .rtt=ROUTES_RTT_UNKNOWN});
         log_debug("Routes insert into bucket %zu.", bkt_idx);
+        return true;
     }
-    else {
-        list_prepend(&routes->replacements[bkt_idx], &node->item);
-        log_debug("Routes insert into replacement cache.");
+
+    if (!(node = routes_node_new(routes, info, time)))
+        return false;
+    struct list_item *replacements = &routes->replacements[bkt_idx];
+    if (routes->replacements_len[bkt_idx] >= routes->replacements_max) {
+        struct kad_node *oldest = cont(replacements->prev, struct kad_node, item);
+        routes_replacement_remove(routes, bkt_idx, oldest);
+        kad_node_slab_put(&routes->nodes, oldest);
+        routes->dropped++;
+        log_debug("Routes dropped oldest replacement of bucket %zu.", bkt_idx);
     }
+    list_prepend(replacements, &node->item);
+    routes_index_insert(routes->index, node->info.id, &node->index);
+    routes->replacements_len[bkt_idx]++;
+    log_debug("Routes insert into replacement cache.");
 
     return true;
 }
@@ -417,10 +604,13 @@ bool routes_upsert(struct kad_routes *routes, const struct kad_node_info *node,
     bool rv = true;
 
     char *id = log_fmt_hex_dyn(LOG_ERR, node->id.bytes, KAD_GUID_SPACE_IN_BYTES);
+    ADDR_STR_DECL(addr);
     if ((rv = routes_update(routes, node, time)))
-        log_debug("Routes update of %s (id=%s).", &node->addr_str, id);
+        log_debug("Routes update of %s (id=%s).",
+                  compact_addr_fmt_log(addr, &node->addr, LOG_DEBUG), id);
     else if ((rv = routes_insert(routes, node, time)))
-        log_debug("Routes insert of %s (id=%s).", &node->addr_str, id);
+        log_debug("Routes insert of %s (id=%s).",
+                  compact_addr_fmt_log(addr, &node->addr, LOG_DEBUG), id);
     else {
         log_error("Failed to upsert kad_node (id=%s).", id);
         rv = false;
@@ -432,8 +622,9 @@ bool routes_upsert(struct kad_routes *routes, const struct kad_node_info *node,
 
 bool routes_delete(struct kad_routes *routes, const kad_guid *node_id)
 {
-    int bkt_idx = kad_bucket_hash(&routes->self_id, node_id);
-    struct kad_node *node = routes_get_from_list(&routes->buckets[bkt_idx], node_id);
+    size_t bkt_idx = 0;
+    bool in_bucket = false;
+    struct kad_node *node = routes_get(routes, node_id, &bkt_idx, &in_bucket);
     if (!node) {
         LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES);
         log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, node_id->bytes);
@@ -441,23 +632,76 @@ bool routes_delete(struct kad_routes *routes, const kad_guid *node_id)
         return false;
     }
 
-    list_delete(&node->item);
-    free_safer(node);
+    if (in_bucket) {
+        struct kad_bucket *bucket = routes->buckets[bkt_idx];
+        kad_bucket_remove(bucket, node - bucket->nodes);
+        routes_promote(routes, bkt_idx);
+    }
+    else {
+        routes_replacement_remove(routes, bkt_idx, node);
+        kad_node_slab_put(&routes->nodes, node);
+    }
     return true;
 }
 
+/**
+ * Flags a node as unresponsive. A bucket node getting too stale is replaced by
+ * the most recently seen replacement node, if any: « If a k-bucket is not full
+ * or its replacement cache is empty, Kademlia merely flags stale contacts
+ * rather than remove them. »
+ */
 bool routes_mark_stale(struct kad_routes *routes, const kad_guid *node_id)
 {
-    struct kad_node *node = routes_get_with_bucket(routes, node_id, NULL, NULL);
+    size_t bkt_idx = 0;
+    bool in_bucket = false;
+    struct kad_node *node = routes_get(routes, node_id, &bkt_idx, &in_bucket);
     if (!node)
         return false;
     node->stale++;
+
+    if (in_bucket && node->stale >= routes->stale_max &&
+        !list_is_empty(&routes->replacements[bkt_idx])) {
+        struct kad_bucket *bucket = routes->buckets[bkt_idx];
+        kad_bucket_remove(bucket, node - bucket->nodes);
+        routes_promote(routes, bkt_idx);
+    }
     return true;
 }
 
+/**
+ * Accounts a round-trip time sample @rtt (ms) of a query to a node. As TCP's
+ * SRTT (RFC 6298), the node's RTT is smoothed with a gain of 1/8.
+ */
+bool routes_rtt_sample(struct kad_routes *routes, const kad_guid *node_id,
+                       long long rtt)
+{
+    struct kad_node *node = routes_get(routes, node_id, NULL, NULL);
+    if (!node || rtt < 0)
+        return false;
+    if (rtt > INT_MAX / 8)
+        rtt = INT_MAX / 8;
+    int r = rtt * 8;
+
+    if (node->rtt == ROUTES_RTT_UNKNOWN)
+        node->rtt = r;
+    else
+        node->rtt += (r - node->rtt) / 8;
+    return true;
+}
+
+/** Returns the smoothed RTT (ms) of a node, or ROUTES_RTT_UNKNOWN. */
+int routes_rtt(struct kad_routes *routes, const kad_guid *node_id)
+{
+    const struct kad_node *node = routes_get(routes, node_id, NULL, NULL);
+    if (!node || node->rtt == ROUTES_RTT_UNKNOWN)
+        return ROUTES_RTT_UNKNOWN;
+    return node->rtt / 8;
+}
+
 /** Populates @routes with routes info read from file @state_path. */
 int routes_read_file(struct kad_routes **routes, const char state_path[])
 {
+    *routes = NULL;
     char buf[ROUTES_STATE_LEN_IN_BYTES];
     size_t buf_len = 0;
     if (!file_read(buf, &buf_len, state_path)) {
@@ -471,7 +715,7 @@ int routes_read_file(struct kad_routes **routes, const char state_path[])
         goto fail;
     }
 
-    if ((*routes = routes_new()) == NULL)
+    if ((*routes = routes_new(ROUTES_SPLIT_DEFAULT)) == NULL)
         goto fail;
 
     (*routes)->self_id = encoded.self_id;
@@ -489,8 +733,10 @@ int routes_read_file(struct kad_routes **routes, const char state_path[])
     return encoded.nodes_len;
 
   fail:
-    if (*routes != NULL)
-        free_safer(*routes);
+    if (*routes != NULL) {
+        routes_destroy(*routes);
+        *routes = NULL;
+    }
     return -1;
 }
 
@@ -500,8 +746,8 @@ routes_encode(const struct kad_routes *routes, struct kad_routes_encoded *encode
 {
     encoded->self_id = routes->self_id;
     size_t start = encoded->nodes_len;
-    for (size_t i = 0; i < KAD_GUID_SPACE_IN_BITS; i++) {
-        encoded->nodes_len += kad_bucket_get_nodes(&routes->buckets[i], encoded->nodes, encoded->nodes_len, KAD_K_CONST, NULL);
+    for (int i = routes->self_bucket; i < KAD_GUID_SPACE_IN_BITS; i++) {
+        encoded->nodes_len += kad_bucket_get_nodes(routes->buckets[i], encoded->nodes, encoded->nodes_len, KAD_K_CONST, NULL);
     }
     return encoded->nodes_len - start;
 }
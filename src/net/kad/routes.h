@@ -16,20 +16,27 @@
 #include "kad_defs.h"
 #include "net/kad/id.h"
 #include "net/socket.h"
+#include "utils/hash.h"
 #include "utils/list.h"
+#include "utils/slab.h"
 
-#define ADDR_STR_LEN INET6_ADDRSTRLEN+INET_PORTSTRLEN
+#define ROUTES_INDEX_SIZE 1024
+#define ROUTES_REPLACEMENTS_MAX KAD_K_CONST
+#define ROUTES_STALE_MAX 5
+#define ROUTES_SLAB_LEN 64
+#define ROUTES_RTT_UNKNOWN -1
 
+/* Copied by value a lot: keep it small. Format addr for logging with
+   compact_addr_fmt_log(). */
 struct kad_node_info {
-    kad_guid                id;
-    struct sockaddr_storage addr;
-    // Textual representation of addr for logging/debugging
-    char                    addr_str[ADDR_STR_LEN];
+    kad_guid            id;
+    struct compact_addr addr;
 };
 
 /* Nodes (DHT) are not peers (network). */
 struct kad_node {
-    struct list_item     item;
+    struct list_item     item;  // in replacement caches only
+    struct list_item     index; // in routes' index, replacement caches only
     struct kad_node_info info;
     time_t               last_seen;
     /* « When a contact fails to respond to 5 RPCs in a row, it is considered
@@ -39,17 +46,39 @@ struct kad_node {
        goes down teporarily, the node won’t completely void all of its
        k-buckets. » */
     int stale;
+    /* Smoothed round-trip time of our queries to this node, in 1/8 ms so
+       that smoothing doesn't lose small changes, or ROUTES_RTT_UNKNOWN. */
+    int rtt;
+};
+
+SLAB_GENERATE(kad_node_slab, struct kad_node, ROUTES_SLAB_LEN)
+
+/**
+ * A k-bucket holds at most KAD_K_CONST nodes in contiguous arrays, ordered by
+ * ascending last_seen time (least recent first). Ids are packed apart, so
+ * that looking a node up only scans @ids; @nodes[i] is the node of @ids[i].
+ */
+struct kad_bucket {
+    size_t          len;
+    kad_guid        ids[KAD_K_CONST];
+    struct kad_node nodes[KAD_K_CONST];
 };
 
 struct kad_routes {
-    kad_guid         self_id;
-    /* The routing table is implemented as hash table: an array of lists
-       (buckets) of at most KAD_K_CONST node entries. Instead of using a
-       generic hash table implementation, we build a specialized one for
-       specific operations on each list. Lists are sorted by design: depending
-       on if we want to evict nodes (buckets) or get the most recent ones
-       (replacements). */
-    struct list_item buckets[KAD_GUID_SPACE_IN_BITS]; // kad_node list
+    kad_guid          self_id;
+    /* The routing table is implemented as hash table: an array of buckets of
+       at most KAD_K_CONST node entries. Instead of using a generic hash table
+       implementation, we build a specialized one for specific operations on
+       each bucket. Buckets and replacement lists are sorted by design:
+       depending on if we want to evict nodes (buckets) or get the most recent
+       ones (replacements). */
+    struct kad_bucket *buckets[KAD_GUID_SPACE_IN_BITS];
+    /* Index of the bucket covering self, which also holds the nodes of all
+       buckets below, which are not allocated. 0 when all buckets are
+       allocated upfront. Otherwise, as in BEP 5, the table starts with one
+       bucket covering the whole space, and only splits self's bucket when
+       full. */
+    int               self_bucket;
     /* « To reduce traffic, Kademlia delays probing contacts until it has
        useful messages to send them. When a Kademlia node receives an RPC from
        an unknown contact and the k-bucket for that contact is already full
@@ -60,7 +89,21 @@ struct kad_routes {
        replacement cache is kept sorted by time last seen, with the most
        recently seen entry having the highest priority as a replacement
        candidate. » */
-    struct list_item replacements[KAD_GUID_SPACE_IN_BITS]; // kad_node list
+    struct list_item  replacements[KAD_GUID_SPACE_IN_BITS]; // kad_node list
+    size_t            replacements_len[KAD_GUID_SPACE_IN_BITS];
+    /* Replacement nodes by id, so that finding a node doesn't walk its
+       replacement list. Bucket nodes don't need it: they are found by
+       scanning at most k contiguous ids, and move within their bucket. */
+    HASH_DECL(index, ROUTES_INDEX_SIZE);
+    // Replacement nodes are allocated from here, and freed all at once.
+    struct kad_node_slab nodes;
+    /* Replacement caches hold at most @replacements_max nodes, the least
+       recently seen being dropped. A bucket node marked stale
+       @stale_max times is replaced with the most recently seen replacement. */
+    size_t             replacements_max;
+    int                stale_max;
+    unsigned long long promoted;
+    unsigned long long dropped;
 };
 
 /**
@@ -87,6 +130,8 @@ bool routes_insert(struct kad_routes *routes, const struct kad_node_info *info,
 bool routes_upsert(struct kad_routes *routes, const struct kad_node_info *node, time_t time);
 bool routes_delete(struct kad_routes *routes, const kad_guid *node_id);
 bool routes_mark_stale(struct kad_routes *routes, const kad_guid *node_id);
+bool routes_rtt_sample(struct kad_routes *routes, const kad_guid *node_id, long long rtt);
+int routes_rtt(struct kad_routes *routes, const kad_guid *node_id);
 size_t routes_find_closest(struct kad_routes *routes, struct kad_node_info nodes[],
                            const kad_guid *target, const kad_guid *caller);
 
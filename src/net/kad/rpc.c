@@ -51,7 +51,8 @@ int kad_rpc_init(struct kad_ctx *ctx, const char conf_dir[])
 
     req_lru_init(ctx->reqs_out);
 
-    kad_lookup_init(&ctx->lookup);
+    kad_lookups_init(&ctx->lookups, KAD_LOOKUPS_DEFAULT);
+    ctx->rtt = (struct kad_rtt_est){0};
 
     log_debug("Rpc state initialized.");
     return nodes_len;
@@ -68,9 +69,16 @@ void kad_rpc_terminate(struct kad_ctx *ctx, const char conf_dir[])
         }
     }
 
+    log_info("Routes: %llu replacements promoted, %llu dropped.",
+             ctx->routes->promoted, ctx->routes->dropped);
+    log_info("RTT: srtt %d ms, rttvar %d ms, timeout %d ms (%llu samples).",
+             ctx->rtt.srtt / 8, ctx->rtt.rttvar / 8,
+             kad_rtt_est_timeout(&ctx->rtt), ctx->rtt.samples);
     routes_destroy(ctx->routes);
 
-    kad_lookup_terminate(&ctx->lookup);
+    iobuf_reset(&ctx->rspbuf);
+
+    kad_lookups_terminate(&ctx->lookups);
 
     timers_free_all(ctx->timers);
 
@@ -137,65 +145,64 @@ kad_lookup_recv(struct kad_ctx *ctx,
                 const struct kad_rpc_msg *msg,
                 const struct kad_rpc_query *query)
 {
-    // FIXME what if round > KAD_K_CONST ?
-
-    if (!kad_lookup_par_remove(&ctx->lookup, query)) {
-        log_error("find_node response for unknown lookup query.");
-        return false;
+    struct kad_lookup *lookup = kad_lookups_get(&ctx->lookups, query->lookup_id);
+    if (!lookup) {
+        log_debug("find_node response for a finished lookup.");
+        return true;
     }
 
+    // Queries of a round which timed out are no longer in flight.
+    bool late = !kad_lookup_par_remove(lookup, query);
+    if (late)
+        log_debug("find_node response after its round timed out.");
+
+    long long now = tick_millis();
+    struct kad_node_info responder = {msg->node_id, query->node.addr};
+    kad_lookup_responded(lookup, &responder,
+                         now >= query->created ? (int)(now - query->created) : 0);
+
     for (size_t i = 0; i < msg->nodes_len; ++i) {
         if (!msg->nodes[i].id.is_set) {
             log_warning("Node id not set, routes not updated.");
             continue;
         }
-        if (!routes_insert(ctx->routes, &msg->nodes[i], 0)) {
-            log_warning("Ignoring failed routes insert.");
-            continue;
-        }
+        (void)routes_upsert(ctx->routes, &msg->nodes[i], 0);
+        if (!kad_seen_add(&lookup->seen, &msg->nodes[i].id))
+            continue; // queried, in flight or queued already
 
-        struct kad_node_lookup *nl = kad_lookup_new_from(&msg->nodes[i], query->msg.target);
+        struct kad_node_lookup *nl = kad_lookup_new_from(
+            lookup, &msg->nodes[i], lookup->target,
+            routes_rtt(ctx->routes, &msg->nodes[i].id));
         if (!nl)
             continue;
-        if (!node_heap_push(&ctx->lookup.next, nl)) {
+        if (!node_heap_push(&lookup->next, nl)) {
             log_error("Failed insert into lookup next nodes.");
-            free_safer(nl);
+            kad_lookup_node_free(lookup, nl);
         }
     }
 
-    if (ctx->lookup.next.buf[0] && ctx->lookup.past.buf[0]) {
-        int next_closer = node_heap_cmp(ctx->lookup.next.buf[0],
-                                        ctx->lookup.past.buf[0]);
-        // FIXME log_debug() node id's with corresponding distance to target.
-        if (next_closer == INT_MIN)
-            log_error("Comparing lookups for different targets.");
-        else
-            ctx->lookup.par_len = next_closer > 0 ? KAD_ALPHA_CONST : KAD_K_CONST;
-        log_debug("lookup.par_len=%d", ctx->lookup.par_len);
-    }
-
-    ctx->lookup.round += 1;
-    log_debug("Lookup round=%d.", ctx->lookup.round);
+    // FIXME log_debug() node id's with corresponding distance to target.
+    if (late)
+        return true; // learned nodes wait for the current round
+    if (!kad_lookup_iterate(lookup))
+        return true; // strict: waiting for the round's other queries
+    log_debug("Lookup round=%d.", lookup->round);
 
-    struct event *evt = malloc(sizeof(struct event));
-    if (!evt) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+    struct event *evt = event_pool_get(ctx->timers->events);
+    if (!evt)
         return false;
-    }
     *evt = (struct event){
         "kad-lookup-next", .cb=event_kad_lookup_next_cb,
-        .args.kad_lookup_next={.target=query->msg.target, .kctx=ctx},
+        .args.kad_lookup_next={.id=lookup->id, .kctx=ctx},
         .fatal=false, .self=evt
     };
 
-    if (!set_timeout(ctx->timers, 0, true, evt))
-        goto cleanup;
+    if (!set_timeout(ctx->timers, 0, true, evt)) {
+        event_pool_put(ctx->timers->events, evt);
+        return false;
+    }
 
     return true;
-
-  cleanup:
-    free_safer(evt);
-    return false;
 }
 
 static bool
@@ -218,6 +225,13 @@ kad_rpc_handle_response(struct kad_ctx *ctx, const struct kad_rpc_msg *msg)
         log_info("Node (id=%s) previously known as (id=%s).", m_id, q_id);
     }
 
+    long long now = tick_millis();
+    if (now >= query->created) {
+        kad_rtt_est_sample(&ctx->rtt, now - query->created);
+        if (routes_rtt_sample(ctx->routes, &msg->node_id, now - query->created))
+            log_debug("Response (id=%s) after %lld ms.", tx_id, now - query->created);
+    }
+
     switch (query->msg.meth) {
     case KAD_RPC_METH_NONE: {
         log_error("Got query for method none.");
@@ -240,7 +254,7 @@ kad_rpc_handle_response(struct kad_ctx *ctx, const struct kad_rpc_msg *msg)
         break;
     }
 
-    free_safer(query);
+    kad_rpc_query_free(ctx, query);
     return true;
 }
 
@@ -290,7 +304,9 @@ static void kad_rpc_msg_log(const struct kad_rpc_msg *msg)
     for (size_t i = 0; i < msg->nodes_len; i++) {
         node_id = log_fmt_hex_dyn(LOG_DEBUG, msg->nodes[i].id.bytes,
                                   KAD_GUID_SPACE_IN_BYTES);
-        log_debug("  nodes[%zu]=0x%s %s", i, node_id, msg->nodes[i].addr_str);
+        ADDR_STR_DECL(addr);
+        log_debug("  nodes[%zu]=0x%s %s", i, node_id,
+                  compact_addr_fmt_log(addr, &msg->nodes[i].addr, LOG_DEBUG));
         free_safer(node_id);
     }
     log_debug("}");
@@ -316,11 +332,12 @@ bool kad_rpc_handle(struct kad_ctx *ctx, const struct sockaddr_storage *addr,
     kad_rpc_msg_log(&msg); // TESTING
 
     time_t now = 0;
-    if (!now_sec(&now))
+    if (!tick_sec(&now))
         return false;
-    struct kad_node_info info = {.id=msg.node_id, .addr=*addr};
-    sockaddr_storage_fmt(info.addr_str, addr);
-    if (msg.node_id.is_set && !routes_upsert(ctx->routes, &info, now))
+    struct kad_node_info info = {.id=msg.node_id};
+    if (!compact_addr_from_sockaddr(&info.addr, addr))
+        log_warning("Routes not updated.");
+    else if (msg.node_id.is_set && !routes_upsert(ctx->routes, &info, now))
         log_warning("Routes update failed.");
 
     switch (msg.type) {
@@ -352,7 +369,8 @@ bool kad_rpc_query_create(struct iobuf *buf,
                           const struct kad_ctx *ctx)
 {
     list_init(&query->litem);
-    if ((query->created = now_millis()) == -1)
+    list_init(&query->timeout.item);
+    if ((query->created = tick_millis()) == -1)
         return false;
     kad_rpc_generate_tx_id(&query->msg.tx_id);
     query->msg.node_id = ctx->routes->self_id;
@@ -364,3 +382,55 @@ bool kad_rpc_query_create(struct iobuf *buf,
     }
     return true;
 }
+
+/**
+ * Frees a query removed from the request list, disarming its timeout and
+ * forgetting it from the lookup's in-flight queries.
+ */
+void kad_rpc_query_free(struct kad_ctx *ctx, struct kad_rpc_query *query)
+{
+    timer_cancel(ctx->timers, &query->timeout);
+    struct kad_lookup *lookup = kad_lookups_get(&ctx->lookups, query->lookup_id);
+    if (lookup)
+        kad_lookup_par_remove(lookup, query);
+    free(query);
+}
+
+/** Feeds @est with a response after @rtt ms. */
+void kad_rtt_est_sample(struct kad_rtt_est *est, long long rtt)
+{
+    if (rtt < 0)
+        return;
+    if (rtt > INT_MAX / 8)
+        rtt = INT_MAX / 8;
+    int r = rtt * 8;
+
+    if (est->samples++ == 0) {
+        est->srtt = r;
+        est->rttvar = r / 2;
+        return;
+    }
+    int err = r - est->srtt;
+    est->srtt += err / 8;
+    est->rttvar += ((err < 0 ? -err : err) - est->rttvar) / 4;
+}
+
+/**
+ * Returns how long to wait for responses, in ms: SRTT + 4·RTTVAR, clamped to
+ * [KAD_RPC_RTO_MIN_MILLIS, KAD_RPC_RTO_MAX_MILLIS]. The variance term is at
+ * least SRTT/2, as steady RTTs would otherwise time slightly slower nodes out.
+ */
+int kad_rtt_est_timeout(const struct kad_rtt_est *est)
+{
+    if (est->samples == 0)
+        return KAD_RPC_RTO_INIT_MILLIS;
+    long long var = 4LL * est->rttvar;
+    if (var < est->srtt / 2)
+        var = est->srtt / 2;
+    long long rto = (est->srtt + var) / 8;
+    if (rto < KAD_RPC_RTO_MIN_MILLIS)
+        return KAD_RPC_RTO_MIN_MILLIS;
+    if (rto > KAD_RPC_RTO_MAX_MILLIS)
+        return KAD_RPC_RTO_MAX_MILLIS;
+    return rto;
+}
@@ -13,13 +13,20 @@
 #include "utils/list.h"
 #include "utils/lookup.h"
 #include "net/kad/bencode/parser.h"
+#include "timers.h"
 
 // #include "net/kad/req_lru.h"
 struct req_lru;
+struct dgram_queue;
+struct timers;
 
 
 // TODO tune and move to defs
 #define KAD_RPC_QUERY_TIMEOUT_MILLIS 60000
+// Bounds of the estimated timeout, the initial one used until a response.
+#define KAD_RPC_RTO_INIT_MILLIS 250
+#define KAD_RPC_RTO_MIN_MILLIS  20
+#define KAD_RPC_RTO_MAX_MILLIS  5000
 
 enum kad_rpc_type {
     KAD_RPC_TYPE_NONE,
@@ -85,16 +92,32 @@ struct kad_rpc_query {
     struct list_item     litem;
     struct list_item     hitem;
     long long            created; // for expiring queries
+    struct timer         timeout; // not allocated, armed by kad_query()
     struct kad_rpc_msg   msg;
     struct kad_node_info node;
+    unsigned             lookup_id; // spawning lookup, 0 if none
+};
+
+/**
+ * Round-trip time estimator over all responses, as TCP's (RFC 6298): smoothed
+ * RTT with gain 1/8 and mean deviation with gain 1/4, both kept in 1/8 ms so
+ * that LAN RTTs of a few ms don't round to nothing.
+ */
+struct kad_rtt_est {
+    int                srtt;   // 1/8 ms
+    int                rttvar; // 1/8 ms
+    unsigned long long samples;
 };
 
 struct kad_ctx {
-    struct kad_routes *routes;
-    struct req_lru    *reqs_out;
-    struct kad_lookup  lookup;
-    struct list_item  *timers;
-    int                sock;
+    struct kad_routes  *routes;
+    struct req_lru     *reqs_out;
+    struct dgram_queue *sendq;
+    struct iobuf        rspbuf; // reused for responses
+    struct kad_lookups  lookups;
+    struct kad_rtt_est  rtt;
+    struct timers      *timers;
+    int                 sock;
 };
 
 int kad_rpc_init(struct kad_ctx *ctx, const char conf_dir[]);
@@ -104,6 +127,10 @@ bool kad_rpc_handle(struct kad_ctx *ctx, const struct sockaddr_storage *addr,
                     const char buf[], const size_t slen, struct iobuf *rsp);
 
 bool kad_rpc_query_create(struct iobuf *buf, struct kad_rpc_query *query, const struct kad_ctx *ctx);
+void kad_rpc_query_free(struct kad_ctx *ctx, struct kad_rpc_query *query);
+
+void kad_rtt_est_sample(struct kad_rtt_est *est, long long rtt);
+int kad_rtt_est_timeout(const struct kad_rtt_est *est);
 
 
 #endif /* KAD_RPC_H */
@@ -1,4 +1,5 @@
 /* Copyright (c) 2019 Foudil Brétel.  All rights reserved. */
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -136,7 +137,7 @@ int socket_init(const int socktype, const char bind_addr[], const char bind_port
         goto cleanup;
     }
 
-    char addr_str[INET6_ADDRSTRLEN+INET_PORTSTRLEN] = {0};
+    ADDR_STR_DECL(addr_str);
     if (!sockaddr_storage_fmt(addr_str, &sa))
         goto cleanup;
     log_info("Socket (%s) bound to %s.",
@@ -156,7 +157,7 @@ bool socket_shutdown(int sock)
 }
 
 /*
- * @str expected to be of length INET6_ADDRSTRLEN + INET_PORTSTRLEN
+ * @str expected to be of length ADDR_STR_LEN
  *      FIXME best to pass len as parameter
  */
 bool sockaddr_storage_fmt(char str[], const struct sockaddr_storage *ss)
@@ -170,7 +171,7 @@ bool sockaddr_storage_fmt(char str[], const struct sockaddr_storage *ss)
         log_error("Failed getnameinfo: %s.", gai_strerror(rv));
         return false;
     }
-    snprintf(str, INET6_ADDRSTRLEN+INET_PORTSTRLEN, "%s/%s", hbuf, pbuf);
+    snprintf(str, ADDR_STR_LEN, "%s/%s", hbuf, pbuf);
     return true;
 }
 
@@ -232,3 +233,118 @@ bool sockaddr_storage_eq(const struct sockaddr_storage *sa,
     else
         return false;
 }
+
+bool compact_addr_set(struct compact_addr *ca, const unsigned char bytes[],
+                      size_t len)
+{
+    if (len != COMPACT_ADDR4_LEN && len != COMPACT_ADDR6_LEN) {
+        log_error("Invalid compact addr length (%zu).", len);
+        return false;
+    }
+    memset(ca, 0, sizeof(*ca));
+    ca->len = len;
+    memcpy(ca->bytes, bytes, len);
+    return true;
+}
+
+bool compact_addr_from_sockaddr(struct compact_addr *ca,
+                                const struct sockaddr_storage *ss)
+{
+    memset(ca, 0, sizeof(*ca));
+    if (ss->ss_family == AF_INET) {
+        const struct sockaddr_in *sa = (struct sockaddr_in *)ss;
+        memcpy(ca->bytes, &sa->sin_addr, 4);
+        memcpy(ca->bytes + 4, &sa->sin_port, 2);
+        ca->len = COMPACT_ADDR4_LEN;
+    }
+    else if (ss->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)ss;
+        memcpy(ca->bytes, &sa6->sin6_addr, 16);
+        memcpy(ca->bytes + 16, &sa6->sin6_port, 2);
+        ca->len = COMPACT_ADDR6_LEN;
+    }
+    else {
+        log_error("Unsupported socket address family (%d).", ss->ss_family);
+        return false;
+    }
+    return true;
+}
+
+bool compact_addr_to_sockaddr(struct sockaddr_storage *ss,
+                              const struct compact_addr *ca)
+{
+    memset(ss, 0, sizeof(*ss));
+    switch (ca->len) {
+    case COMPACT_ADDR4_LEN: {
+        struct sockaddr_in *sa = (struct sockaddr_in *)ss;
+        sa->sin_family = AF_INET;
+        memcpy(&sa->sin_addr, ca->bytes, 4);
+        memcpy(&sa->sin_port, ca->bytes + 4, 2);
+        break;
+    }
+
+    case COMPACT_ADDR6_LEN: {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)ss;
+        sa6->sin6_family = AF_INET6;
+        memcpy(&sa6->sin6_addr, ca->bytes, 16);
+        memcpy(&sa6->sin6_port, ca->bytes + 16, 2);
+        break;
+    }
+
+    default:
+        log_error("Invalid compact addr length (%d).", ca->len);
+        return false;
+    }
+    return true;
+}
+
+bool compact_addr_eq(const struct compact_addr *a, const struct compact_addr *b)
+{
+    return a->len == b->len && memcmp(a->bytes, b->bytes, a->len) == 0;
+}
+
+/** Compares ip addresses only, regardless of ports. */
+bool compact_addr_eq_ip(const struct compact_addr *a,
+                        const struct compact_addr *b)
+{
+    return a->len == b->len && a->len > 2 &&
+        memcmp(a->bytes, b->bytes, a->len - 2) == 0;
+}
+
+/*
+ * Same format as sockaddr_storage_fmt(), without getnameinfo(3).
+ *
+ * @str expected to be of length ADDR_STR_LEN
+ */
+bool compact_addr_fmt(char str[], const struct compact_addr *ca)
+{
+    int af = ca->len == COMPACT_ADDR4_LEN ? AF_INET :
+        ca->len == COMPACT_ADDR6_LEN ? AF_INET6 : AF_UNSPEC;
+    if (af == AF_UNSPEC) {
+        log_error("Invalid compact addr length (%d).", ca->len);
+        return false;
+    }
+
+    char hbuf[INET6_ADDRSTRLEN] = {0};
+    if (!inet_ntop(af, ca->bytes, hbuf, sizeof(hbuf))) {
+        log_perror(LOG_ERR, "Failed inet_ntop: %s.", errno);
+        return false;
+    }
+    in_port_t port;
+    memcpy(&port, ca->bytes + ca->len - 2, 2);
+    snprintf(str, ADDR_STR_LEN, "%s/%u", hbuf, ntohs(port));
+    return true;
+}
+
+/**
+ * Formats @ca into @str only if messages of @prio are logged, so that
+ * addresses cost nothing in disabled log messages. Returns @str, left as is
+ * otherwise: initialize it with ADDR_STR_DECL().
+ */
+const char *compact_addr_fmt_log(char str[], const struct compact_addr *ca,
+                                 const int prio)
+{
+    if (log_is_enabled(prio))
+        compact_addr_fmt(str, ca);
+    return str;
+}
@@ -4,8 +4,24 @@
 
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define INET_PORTSTRLEN 6 /* Including terminating null */
+#define ADDR_STR_LEN (INET6_ADDRSTRLEN+INET_PORTSTRLEN)
+#define ADDR_STR_DECL(name) char name[ADDR_STR_LEN] = {0}
+
+#define COMPACT_ADDR4_LEN 6
+#define COMPACT_ADDR6_LEN 18
+
+/**
+ * "Compact IP-address/port info" (BEP 5): the 4-byte (16-byte for ip6) ip
+ * address followed by the 2-byte port, network-ordered. This is how node
+ * addresses are stored and sent; a sockaddr_storage is 128 bytes.
+ */
+struct compact_addr {
+    unsigned char len; // COMPACT_ADDR4_LEN, COMPACT_ADDR6_LEN or 0 when unset
+    unsigned char bytes[COMPACT_ADDR6_LEN];
+};
 
 bool sock_close(int fd);
 int socket_init(const int socktype, const char bind_addr[], const char bind_port[]);
@@ -15,4 +31,12 @@ bool sockaddr_storage_fmt(char str[], const struct sockaddr_storage *ss);
 bool sockaddr_storage_eq(const struct sockaddr_storage *sa, const struct sockaddr_storage *sb);
 bool sockaddr_storage_eq_addr(const struct sockaddr_storage *sa, const struct sockaddr_storage *sb);
 
+bool compact_addr_set(struct compact_addr *ca, const unsigned char bytes[], size_t len);
+bool compact_addr_from_sockaddr(struct compact_addr *ca, const struct sockaddr_storage *ss);
+bool compact_addr_to_sockaddr(struct sockaddr_storage *ss, const struct compact_addr *ca);
+bool compact_addr_eq(const struct compact_addr *a, const struct compact_addr *b);
+bool compact_addr_eq_ip(const struct compact_addr *a, const struct compact_addr *b);
+bool compact_addr_fmt(char str[], const struct compact_addr *ca);
+const char *compact_addr_fmt_log(char str[], const struct compact_addr *ca, const int prio);
+
 #endif /* SOCKET_H */
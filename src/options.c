@@ -20,6 +20,9 @@ const struct config CONFIG_DEFAULT = {
     .log_type  = LOG_TYPE_STDOUT,
     .log_level = LOG_UPTO(LOG_INFO),
     .max_peers = 256,
+    .max_lookups = KAD_LOOKUPS_DEFAULT,
+    .lookup_par = KAD_LOOKUP_PAR_DEFAULT,
+    .poller    = POLLER_BACKEND_DEFAULT,
 };
 
 static void usage(void)
@@ -27,7 +30,10 @@ static void usage(void)
     printf("Usage: %s [parameters]\n", PACKAGE_NAME);
     printf("\nParameters:\n"
            " -a, --addr=[addr]       Set bind address (ip4 or ip6)\n"
+           " -b, --backend=[name]    Set event loop backend (epoll, poll)\n"
            " -c, --config=[path]     Set the config directory path\n"
+           " -j, --parallel=[mode]   Set lookup parallelism (strict, bounded, loose)\n"
+           " -k, --max-lookups=[max] Set maximum number of concurrent lookups\n"
            " -l, --log=[level]       Set log level (debug..critical)\n"
            " -m, --max-peers=[max]   Set maximum number of peers\n"
            " -o, --output=[file]     Set log output file\n"
@@ -85,7 +91,10 @@ int options_parse(struct config *conf, const int argc, char *const argv[])
         int option_index = 0;
         static struct option long_options[] = {
             {"addr",       required_argument, 0, 'a'},
+            {"backend",    required_argument, 0, 'b'},
             {"config",     required_argument, 0, 'c'},
+            {"parallel",   required_argument, 0, 'j'},
+            {"max-lookups", required_argument, 0, 'k'},
             {"log",        required_argument, 0, 'l'},
             {"max-peers",  required_argument, 0, 'm'},
             {"output",     required_argument, 0, 'o'},
@@ -96,7 +105,7 @@ int options_parse(struct config *conf, const int argc, char *const argv[])
             {0}
         };
 
-        int c = getopt_long(argc, argv, "a:c:l:m:o:p:shv",
+        int c = getopt_long(argc, argv, "a:b:c:j:k:l:m:o:p:shv",
                             long_options, &option_index);
         if (c == -1)
             break;
@@ -109,6 +118,17 @@ int options_parse(struct config *conf, const int argc, char *const argv[])
             }
             break;
 
+        case 'b': {
+            int backend = lookup_by_name(poller_backend_names, optarg,
+                                         strlen(optarg) + 1);
+            if (!backend || !poller_backend_available(backend)) {
+                fprintf(stderr, "Wrong value for --backend.\n");
+                return 1;
+            }
+            conf->poller = backend;
+            break;
+        }
+
         case 'c':
             if (!strcpy_safer(conf->conf_dir, optarg, sizeof(conf->conf_dir))) {
                 fprintf(stderr, "Wrong value for --config.\n");
@@ -116,6 +136,30 @@ int options_parse(struct config *conf, const int argc, char *const argv[])
             }
             break;
 
+        case 'j': {
+            int mode = lookup_by_name(kad_lookup_par_names, optarg,
+                                      strlen(optarg) + 1);
+            if (!mode) {
+                fprintf(stderr, "Wrong value for --parallel.\n");
+                return 1;
+            }
+            conf->lookup_par = mode;
+            break;
+        }
+
+        case 'k': {
+            errno = 0;
+            long val = strtol(optarg, NULL, 10);
+            if ((errno != 0 && val == 0)
+                || (val < 1 || val > KAD_LOOKUPS_MAX)) {
+                fprintf(stderr, "Wrong value for --max-lookups."
+                        " Should be in [1, %d].\n", KAD_LOOKUPS_MAX);
+                return 1;
+            }
+            conf->max_lookups = (size_t)val;
+            break;
+        }
+
         case 'l': {
             int sevmask = 0;
             for (int i = 0; log_severities[i].id; i++) {
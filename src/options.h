@@ -5,6 +5,8 @@
 #include <limits.h>
 #include <netdb.h>
 #include "log.h"
+#include "net/kad/lookup.h"
+#include "poller.h"
 
 struct config {
     char       conf_dir[PATH_MAX];
@@ -13,6 +15,9 @@ struct config {
     log_type_t log_type;
     int        log_level;
     size_t     max_peers;
+    size_t     max_lookups;
+    enum kad_lookup_par lookup_par;
+    enum poller_backend poller;
 };
 
 extern const struct config CONFIG_DEFAULT;
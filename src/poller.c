@@ -0,0 +1,300 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+#include "log.h"
+#include "utils/bits.h"
+#include "utils/safer.h"
+#include "poller.h"
+
+#define POLL_EVENTS POLLIN|POLLPRI
+
+static bool poller_poll_init(struct poller *p)
+{
+    p->poll.fds = calloc(p->cap, sizeof(struct pollfd));
+    if (!p->poll.fds) {
+        log_perror(LOG_ERR, "Failed calloc: %s.", errno);
+        return false;
+    }
+    return true;
+}
+
+static void poller_poll_terminate(struct poller *p)
+{
+    free_safer(p->poll.fds);
+}
+
+static short poller_poll_events(unsigned events)
+{
+    short pevents = 0;
+    if (BITS_CHK(events, POLLER_IN))
+        BITS_SET(pevents, POLL_EVENTS);
+    if (BITS_CHK(events, POLLER_OUT))
+        BITS_SET(pevents, POLLOUT);
+    return pevents;
+}
+
+static bool poller_poll_add(struct poller *p, int fd, unsigned events)
+{
+    struct pollfd *pfd = &p->poll.fds[p->len];
+    pfd->fd = fd;
+    pfd->events = poller_poll_events(events);
+    pfd->revents = 0;
+    return true;
+}
+
+static bool poller_poll_mod(struct poller *p, int fd, unsigned events)
+{
+    for (size_t i = 0; i < p->len; ++i) {
+        if (p->poll.fds[i].fd != fd)
+            continue;
+        p->poll.fds[i].events = poller_poll_events(events);
+        return true;
+    }
+    return false;
+}
+
+/** Swap with last entry, as registration order doesn't matter. */
+static bool poller_poll_del(struct poller *p, int fd)
+{
+    for (size_t i = 0; i < p->len; ++i) {
+        if (p->poll.fds[i].fd != fd)
+            continue;
+        p->poll.fds[i] = p->poll.fds[p->len - 1];
+        return true;
+    }
+    return false;
+}
+
+static int
+poller_poll_wait(struct poller *p, struct poller_event evs[], int timeout)
+{
+    if (poll(p->poll.fds, p->len, timeout) < 0)
+        return -1;
+
+    int nev = 0;
+    for (size_t i = 0; i < p->len; ++i) {
+        const struct pollfd *pfd = &p->poll.fds[i];
+        if (pfd->revents == 0)
+            continue;
+        evs[nev].fd = pfd->fd;
+        evs[nev].events = 0;
+        if (BITS_CHK(pfd->revents, POLL_EVENTS))
+            BITS_SET(evs[nev].events, POLLER_IN);
+        if (BITS_CHK(pfd->revents, POLLOUT))
+            BITS_SET(evs[nev].events, POLLER_OUT);
+        if (BITS_CHK(pfd->revents, POLLERR|POLLHUP|POLLNVAL))
+            BITS_SET(evs[nev].events, POLLER_ERR);
+        nev++;
+    }
+    return nev;
+}
+
+static const struct poller_ops poller_poll_ops = {
+    .init      = poller_poll_init,
+    .terminate = poller_poll_terminate,
+    .add       = poller_poll_add,
+    .mod       = poller_poll_mod,
+    .del       = poller_poll_del,
+    .wait      = poller_poll_wait,
+};
+
+#ifdef HAVE_EPOLL
+static bool poller_epoll_init(struct poller *p)
+{
+    p->epoll.fd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->epoll.fd < 0) {
+        log_perror(LOG_ERR, "Failed epoll_create1: %s.", errno);
+        return false;
+    }
+    p->epoll.evs = calloc(p->cap, sizeof(struct epoll_event));
+    if (!p->epoll.evs) {
+        log_perror(LOG_ERR, "Failed calloc: %s.", errno);
+        close(p->epoll.fd);
+        return false;
+    }
+    return true;
+}
+
+static void poller_epoll_terminate(struct poller *p)
+{
+    free_safer(p->epoll.evs);
+    if (close(p->epoll.fd) < 0)
+        log_perror(LOG_ERR, "Failed close: %s.", errno);
+}
+
+static bool
+poller_epoll_ctl(struct poller *p, int op, int fd, unsigned events)
+{
+    struct epoll_event ev = {0};
+    if (BITS_CHK(events, POLLER_IN))
+        BITS_SET(ev.events, EPOLLIN|EPOLLPRI);
+    if (BITS_CHK(events, POLLER_OUT))
+        BITS_SET(ev.events, EPOLLOUT);
+    ev.data.fd = fd;
+    if (epoll_ctl(p->epoll.fd, op, fd, &ev) < 0) {
+        log_perror(LOG_ERR, "Failed epoll_ctl: %s.", errno);
+        return false;
+    }
+    return true;
+}
+
+static bool poller_epoll_add(struct poller *p, int fd, unsigned events)
+{
+    return poller_epoll_ctl(p, EPOLL_CTL_ADD, fd, events);
+}
+
+static bool poller_epoll_mod(struct poller *p, int fd, unsigned events)
+{
+    return poller_epoll_ctl(p, EPOLL_CTL_MOD, fd, events);
+}
+
+static bool poller_epoll_del(struct poller *p, int fd)
+{
+    if (epoll_ctl(p->epoll.fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        log_perror(LOG_ERR, "Failed epoll_ctl: %s.", errno);
+        return false;
+    }
+    return true;
+}
+
+static int
+poller_epoll_wait(struct poller *p, struct poller_event evs[], int timeout)
+{
+    struct epoll_event *eevs = p->epoll.evs;
+    int nev = epoll_wait(p->epoll.fd, eevs, p->cap, timeout);
+    for (int i = 0; i < nev; ++i) {
+        evs[i].fd = eevs[i].data.fd;
+        evs[i].events = 0;
+        if (BITS_CHK(eevs[i].events, EPOLLIN|EPOLLPRI))
+            BITS_SET(evs[i].events, POLLER_IN);
+        if (BITS_CHK(eevs[i].events, EPOLLOUT))
+            BITS_SET(evs[i].events, POLLER_OUT);
+        if (BITS_CHK(eevs[i].events, EPOLLERR|EPOLLHUP))
+            BITS_SET(evs[i].events, POLLER_ERR);
+    }
+    return nev;
+}
+
+static const struct poller_ops poller_epoll_ops = {
+    .init      = poller_epoll_init,
+    .terminate = poller_epoll_terminate,
+    .add       = poller_epoll_add,
+    .mod       = poller_epoll_mod,
+    .del       = poller_epoll_del,
+    .wait      = poller_epoll_wait,
+};
+#endif
+
+static const struct poller_ops *poller_backend_ops(enum poller_backend backend)
+{
+    switch (backend) {
+    case POLLER_BACKEND_POLL:
+        return &poller_poll_ops;
+#ifdef HAVE_EPOLL
+    case POLLER_BACKEND_EPOLL:
+        return &poller_epoll_ops;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+bool poller_backend_available(enum poller_backend backend)
+{
+    return poller_backend_ops(backend) != NULL;
+}
+
+bool poller_init(struct poller *p, enum poller_backend backend, size_t cap)
+{
+    const struct poller_ops *ops = poller_backend_ops(backend);
+    if (!ops) {
+        log_error("Unsupported poller backend (%d).", backend);
+        return false;
+    }
+
+    *p = (struct poller){.backend=backend, .ops=ops, .len=0, .cap=cap,
+                         .data=NULL, .data_len=0};
+    if (!p->ops->init(p))
+        return false;
+
+    log_info("Using %s backend.", lookup_by_id(poller_backend_names, backend));
+    return true;
+}
+
+void poller_terminate(struct poller *p)
+{
+    p->ops->terminate(p);
+    free_safer(p->data);
+    p->data_len = 0;
+    p->len = 0;
+}
+
+/** fds are allocated lowest first, so that the array stays dense. */
+static bool poller_data_set(struct poller *p, int fd, void *data)
+{
+    if ((size_t)fd >= p->data_len) {
+        size_t len = p->data_len ? p->data_len : 16;
+        while (len <= (size_t)fd)
+            len *= 2;
+        void **realloced = realloc(p->data, len * sizeof(void *));
+        if (!realloced) {
+            log_perror(LOG_ERR, "Failed realloc: %s.", errno);
+            return false;
+        }
+        memset(realloced + p->data_len, 0,
+               (len - p->data_len) * sizeof(void *));
+        p->data = realloced;
+        p->data_len = len;
+    }
+    p->data[fd] = data;
+    return true;
+}
+
+bool poller_add(struct poller *p, int fd, unsigned events, void *data)
+{
+    if (p->len >= p->cap) {
+        log_error("Poller full (%zu fds), can't register fd=%d.", p->cap, fd);
+        return false;
+    }
+    if (fd < 0 || !poller_data_set(p, fd, data))
+        return false;
+    if (!p->ops->add(p, fd, events)) {
+        p->data[fd] = NULL;
+        return false;
+    }
+    p->len++;
+    return true;
+}
+
+bool poller_mod(struct poller *p, int fd, unsigned events)
+{
+    if (!p->ops->mod(p, fd, events)) {
+        log_error("Failed to modify fd=%d.", fd);
+        return false;
+    }
+    return true;
+}
+
+bool poller_del(struct poller *p, int fd)
+{
+    if (!p->ops->del(p, fd)) {
+        log_error("Failed to unregister fd=%d.", fd);
+        return false;
+    }
+    p->data[fd] = NULL;
+    p->len--;
+    return true;
+}
+
+int poller_wait(struct poller *p, struct poller_event evs[], int timeout)
+{
+    int nev = p->ops->wait(p, evs, timeout);
+    for (int i = 0; i < nev; ++i)
+        evs[i].data = poller_data(p, evs[i].fd);
+    return nev;
+}
@@ -0,0 +1,102 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#ifndef POLLER_H
+#define POLLER_H
+
+/**
+ * I/O readiness backends for the event loop.
+ *
+ * poll(2) is portable, but the whole fd array has to be handed to the kernel
+ * and scanned after each wakeup, so that the cost of a loop iteration grows
+ * with the number of connected peers. epoll(7) keeps registrations in the
+ * kernel and only reports ready fds.
+ *
+ * Either way, fds are registered once (when a peer connects) and unregistered
+ * once (when it disconnects), rather than rebuilt on every loop iteration.
+ * Each registration carries a @data pointer (ex: the peer), stored in an
+ * fd-indexed array, so that ready fds map to their owner in O(1).
+ * Backends are selected at build time (`-Dpoller=`) and can be overridden at
+ * runtime (`--backend`).
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include "utils/lookup.h"
+
+enum poller_backend {
+    POLLER_BACKEND_NONE,
+    POLLER_BACKEND_POLL,
+    POLLER_BACKEND_EPOLL,
+};
+
+static const lookup_entry poller_backend_names[] = {
+    { POLLER_BACKEND_POLL,  "poll" },
+    { POLLER_BACKEND_EPOLL, "epoll" },
+    { 0,                    NULL },
+};
+
+#define POLLER_IN  (1 << 0)
+#define POLLER_OUT (1 << 1)
+#define POLLER_ERR (1 << 2)
+
+struct poller_event {
+    int      fd;
+    unsigned events;
+    void    *data;
+};
+
+struct poller;
+
+struct poller_ops {
+    bool (*init)(struct poller *p);
+    void (*terminate)(struct poller *p);
+    bool (*add)(struct poller *p, int fd, unsigned events);
+    bool (*mod)(struct poller *p, int fd, unsigned events);
+    bool (*del)(struct poller *p, int fd);
+    int  (*wait)(struct poller *p, struct poller_event evs[], int timeout);
+};
+
+/**
+ * Initialize with poller_init(). @cap is the maximum number of registered fds.
+ */
+struct poller {
+    enum poller_backend      backend;
+    const struct poller_ops *ops;
+    size_t                   len;
+    size_t                   cap;
+    void                   **data;     // indexed by fd
+    size_t                   data_len;
+    union {
+        struct {
+            struct pollfd *fds;
+        } poll;
+        struct {
+            int   fd;
+            void *evs;
+        } epoll;
+    };
+};
+
+bool poller_backend_available(enum poller_backend backend);
+bool poller_init(struct poller *p, enum poller_backend backend, size_t cap);
+void poller_terminate(struct poller *p);
+/** @data is handed back with @fd's readiness events, may be NULL. */
+bool poller_add(struct poller *p, int fd, unsigned events, void *data);
+/** Replaces the watched @events of an already registered @fd. */
+bool poller_mod(struct poller *p, int fd, unsigned events);
+bool poller_del(struct poller *p, int fd);
+/**
+ * Waits for at most @timeout ms (-1 for infinite) and fills @evs, which MUST
+ * be of length @p->cap.
+ *
+ * Returns the number of ready fds, or -1 on error (errno set).
+ */
+int poller_wait(struct poller *p, struct poller_event evs[], int timeout);
+
+/** Returns the @data registered with @fd, or NULL. */
+static inline void *poller_data(const struct poller *p, int fd)
+{
+    if (fd < 0 || (size_t)fd >= p->data_len)
+        return NULL;
+    return p->data[fd];
+}
+
+#endif /* POLLER_H */
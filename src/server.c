@@ -1,11 +1,11 @@
 /* Copyright (c) 2017 Foudil Brétel.  All rights reserved. */
-#include <poll.h>
 #include "events.h"
 #include "log.h"
 #include "net/actions.h"
 #include "net/kad/req_lru.h"
 #include "net/kad/rpc.h"
 #include "net/socket.h"
+#include "poller.h"
 #include "signals.h"
 #include "timers.h"
 #include "utils/bits.h"
@@ -14,34 +14,11 @@
 #include "utils/time.h"
 #include "server.h"
 
-#define POLL_EVENTS POLLIN|POLLPRI
-
-static int pollfds_update(struct pollfd fds[], const int nlisten,
-                          struct list_item *peers)
-{
-    struct list_item * it = peers;
-    int npeer = nlisten;
-    list_for(it, peers) {
-        const struct peer *p = cont(it, struct peer, item);
-        if (!p) {
-            log_error("Undefined container in list.");
-            return npeer;
-        }
-
-        fds[npeer].fd = p->fd;
-        /* TODO: we will have to add POLLOUT when all data haven't been written
-           in one loop, and probably have 1 inbuf and 1 outbuf. */
-        fds[npeer].events = POLL_EVENTS;
-        npeer++;
-    }
-    return npeer;
-}
-
 /**
  * Main event loop
  *
- * poll(2) is portable and should be sufficient as we don't expect to handle
- * thousands of peer connections.
+ * Readiness notification is delegated to a poller backend (poller.h): poll(2)
+ * is portable, epoll(7) scales better with thousands of peer connections.
  *
  * Initially inspired from
  * https://www.ibm.com/support/knowledgecenter/en/ssw_i5_54/rzab6/poll.htm
@@ -75,11 +52,20 @@ bool server_run(const struct config *conf)
     event_queue evq;
     event_queue_init(&evq);
 
-    long long tick_init = now_millis();
+    long long tick_init = tick_update();
     if (tick_init < 0)
         return false;
     log_debug("tick_init=%lld", tick_init);
-    struct list_item timers = LIST_ITEM_INIT(timers);
+    struct timers timers;
+    if (!timers_init(&timers))
+        return false;
+    // Too big for the stack.
+    static struct event_pool event_pool;
+    static struct timer_pool timer_pool;
+    event_pool_init(&event_pool);
+    timer_pool_init(&timer_pool);
+    timers.events = &event_pool;
+    timers.pool = &timer_pool;
 
     struct timer timer_kad_refresh = {
         .name="kad-refresh", .delay=TIMER_KAD_REFRESH_MILLIS,
@@ -93,17 +79,21 @@ bool server_run(const struct config *conf)
     kctx.sock = sock_udp;
     struct req_lru reqs_out = {0};
     kctx.reqs_out = &reqs_out;
+    // Too big for the stack.
+    static struct node_recv nrecv;
+    static struct dgram_queue sendq;
+    kctx.sendq = &sendq;
     int nodes_len = kad_rpc_init(&kctx, conf->conf_dir);
+    kctx.lookups.max = conf->max_lookups;
+    kctx.lookups.mode = conf->lookup_par;
     if (nodes_len == -1) {
         log_fatal("Failed to initialize routes. Aborting.");
         return false;
     }
     else if (nodes_len == 0) {
-        struct event *event_kad_bootstrap = malloc(sizeof(struct event));
-        if (!event_kad_bootstrap) {
-            log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+        struct event *event_kad_bootstrap = event_pool_get(&event_pool);
+        if (!event_kad_bootstrap)
             return false;
-        }
         *event_kad_bootstrap = (struct event){
             "kad-bootstrap", .cb=event_kad_bootstrap_cb,
             .args.kad_bootstrap={.conf=conf, .kctx=&kctx},
@@ -112,10 +102,9 @@ bool server_run(const struct config *conf)
 
         // Need to schedule event instead of adding to event queue, otherwise
         // applied after poll returns.
-        struct timer *timer_kad_bootstrap = malloc(sizeof(struct timer));
+        struct timer *timer_kad_bootstrap = timer_pool_get(&timer_pool);
         if (!timer_kad_bootstrap) {
-            log_perror(LOG_ERR, "Failed malloc: %s.", errno);
-            free_safer(event_kad_bootstrap);
+            event_pool_put(&event_pool, event_kad_bootstrap);
             return false;
         }
         *timer_kad_bootstrap = (struct timer){
@@ -129,13 +118,19 @@ bool server_run(const struct config *conf)
     }
 
     int nlisten = 2;
-    int nfds = nlisten + conf->max_peers;
-    struct pollfd fds[nfds];
-    memset(fds, 0, sizeof(fds));
-    fds[0].fd = sock_udp;
-    fds[0].events = POLL_EVENTS;
-    fds[1].fd = sock_tcp;
-    fds[1].events = POLL_EVENTS;
+    size_t nfds = nlisten + conf->max_peers;
+    struct poller poller = {0};
+    if (!poller_init(&poller, conf->poller, nfds)) {
+        log_fatal("Failed to initialize poller. Aborting.");
+        return false;
+    }
+    if (!poller_add(&poller, sock_udp, POLLER_IN, NULL) ||
+        !poller_add(&poller, sock_tcp, POLLER_IN, NULL)) {
+        log_fatal("Failed to register sockets. Aborting.");
+        poller_terminate(&poller);
+        return false;
+    }
+    struct poller_event evs[nfds];
     struct list_item peers = LIST_ITEM_INIT(peers);
 
     while (true) {
@@ -146,6 +141,11 @@ bool server_run(const struct config *conf)
             break;
         }
 
+        if (tick_update() < 0) {
+            log_fatal("Failed to read clock. Aborting.");
+            ret = false;
+            break;
+        }
         int timeout = timers_get_soonest(&timers);
         if (timeout < -1) {
             log_fatal("Timeout calculation failed (%d). Aborting.", timeout);
@@ -153,7 +153,8 @@ bool server_run(const struct config *conf)
             break;
         }
         log_debug("Waiting to poll (timeout=%li)...", timeout);
-        if (poll(fds, nfds, timeout) < 0) {  // event_wait
+        int nev = poller_wait(&poller, evs, timeout);  // event_wait
+        if (nev < 0) {
             if (errno == EINTR)
                 continue;
             else {
@@ -162,30 +163,38 @@ bool server_run(const struct config *conf)
                 break;
             }
         }
+        // Time is frozen from here until the next iteration.
+        if (tick_update() < 0) {
+            log_fatal("Failed to read clock. Aborting.");
+            ret = false;
+            break;
+        }
 
-        for (int i = 0; i < nfds; i++) {
+        for (int i = 0; i < nev; i++) {
             // event_get_next
-            if (fds[i].revents == 0)
-                continue;
-
-            if (!BITS_CHK(fds[i].revents, POLL_EVENTS)) {
-                log_error("Unexpected revents: %#x", fds[i].revents);
+            if (!BITS_CHK(evs[i].events, POLLER_IN|POLLER_OUT)) {
+                log_error("Unexpected events: %#x", evs[i].events);
                 ret = false;
                 goto server_end;
             }
 
-            if (fds[i].fd == sock_udp) {
+            if (evs[i].fd == sock_udp) {
+                // Writability is handled by the flush below.
+                if (!BITS_CHK(evs[i].events, POLLER_IN))
+                    continue;
                 event_node_data.args.node_data.kctx = &kctx;
+                event_node_data.args.node_data.recv = &nrecv;
                 if (!event_queue_put(&evq, &event_node_data)) {
                     log_error("Enqueue event '%s' failed.", event_node_data.name);
                 }
                 continue;
             }
 
-            if (fds[i].fd == sock_tcp) {
+            if (evs[i].fd == sock_tcp) {
                 event_peer_conn.args.peer_conn.sock = sock_tcp;
                 event_peer_conn.args.peer_conn.peers = &peers;
-                event_peer_conn.args.peer_conn.nfds = nfds;
+                event_peer_conn.args.peer_conn.poller = &poller;
+                event_peer_conn.args.peer_conn.kctx = &kctx;
                 event_peer_conn.args.peer_conn.conf = conf;
                 if (!event_queue_put(&evq, &event_peer_conn)) {
                     log_error("Enqueue event '%s' failed.", event_peer_conn.name);
@@ -194,26 +203,19 @@ bool server_run(const struct config *conf)
             }
 
             {
-                log_debug("Data available on fd %d.", fds[i].fd);
-                struct event *event_peer_data = malloc(sizeof(struct event));
-                if (!event_peer_data) {
-                    log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+                log_debug("Data available on fd %d.", evs[i].fd);
+                struct peer *peer = evs[i].data;
+                if (!peer) {
+                    log_fatal("Unregistered peer fd=%d.", evs[i].fd);
                     ret = false;
                     goto server_end;
                 }
-                *event_peer_data = (struct event){
-                    "peer-data", .cb=event_peer_data_cb, .args={{{0}}}, .fatal=true,
-                    .self=event_peer_data
-                };
-                event_peer_data->args.peer_data.peers = &peers;
-                event_peer_data->args.peer_data.kctx = &kctx;
-                event_peer_data->args.peer_data.fd = fds[i].fd;
-                if (!event_queue_put(&evq, event_peer_data)) {
-                    log_error("Enqueue event '%s' failed.", event_peer_data->name);
+                if (!event_queue_put(&evq, &peer->event)) {
+                    log_error("Enqueue event '%s' failed.", peer->event.name);
                 }
             }
 
-        } /* End loop poll fds */
+        } /* End loop ready fds */
 
         if (!timers_apply(&timers, &evq)) {
             log_error("Failed to apply all timers.");
@@ -222,6 +224,7 @@ bool server_run(const struct config *conf)
         }
 
         // event_dispatch
+        log_debug("Dispatching %zu events.", evq.len);
         while (event_queue_status(&evq) != QUEUE_STATE_EMPTY) {
             struct event *ev = event_queue_get(&evq);
             if (!ev) {
@@ -229,25 +232,47 @@ bool server_run(const struct config *conf)
                 continue;
             }
             log_debug("Triggering event '%s'.", ev->name);
-            if (!ev->cb(ev->args) && ev->fatal) {
+            // Embedded events may be gone with their owner after the callback.
+            struct event *self = ev->self;
+            bool fatal = ev->fatal;
+            if (!ev->cb(ev->args) && fatal) {
                 ret = false;
             };
-            if (ev->self) {
-                free_event(ev->self);
+            if (self) {
+                free_event(&event_pool, self);
             }
             if (!ret) {
                 goto server_end;
             }
         }
 
-        nfds = pollfds_update(fds, nlisten, &peers);
+        // event_flush
+        if (!node_flush_data(&kctx, &poller)) {
+            log_error("Failed to flush UDP send queue.");
+            ret = false;
+            break;
+        }
 
     } /* End event loop */
 
   server_end:
-    peer_conn_close_all(&peers);
+    peer_conn_close_all(&peers, &poller);
+    poller_terminate(&poller);
 
+    log_info("UDP: %llu datagrams over %llu wakeups (max batch %zu).",
+             nrecv.datagrams, nrecv.wakeups, nrecv.batch_max);
+    log_info("UDP: %llu datagrams sent over %llu flushes, %llu dropped"
+             " (max queued %zu).",
+             sendq.sent, sendq.flushes, sendq.dropped, sendq.len_max);
+    log_info("Timers: %llu periods missed.", timers.missed);
+    log_info("Event queue: %zu events at most per iteration, %llu spilled.",
+             evq.len_max, evq.spilled);
     kad_rpc_terminate(&kctx, conf->conf_dir);
+    log_info("Pools: %zu events (%llu malloc'd), %zu timers (%llu malloc'd)"
+             " at most.", event_pool.used_max, event_pool.fallbacks,
+             timer_pool.used_max, timer_pool.fallbacks);
+
+    event_queue_reset(&evq);
 
     socket_shutdown(sock_tcp);
     socket_shutdown(sock_udp);
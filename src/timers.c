@@ -1,130 +1,359 @@
 /* Copyright (c) 2019 Foudil Brétel.  All rights reserved. */
 #include <limits.h>
 #include "log.h"
+#include "utils/bits.h"
 #include "utils/cont.h"
 #include "utils/time.h"
 #include "utils/safer.h"
 #include "timers.h"
 
-bool set_timeout(struct list_item *timers, long long delay, bool once,
-                 struct event *evt)
+#define TIMERS_WHEEL_MASK  (TIMERS_WHEEL_SLOTS - 1)
+#define TIMERS_LEVEL_SHIFT(level) ((level) * TIMERS_WHEEL_BITS)
+#define TIMERS_RANGE_BITS  TIMERS_LEVEL_SHIFT(TIMERS_WHEEL_LEVELS)
+#define TIMERS_RANGE_MASK  ((1LL << TIMERS_RANGE_BITS) - 1)
+
+bool timers_init(struct timers *timers)
 {
-    struct timer *timer = malloc(sizeof(struct timer));
-    if (!timer) {
-        log_perror(LOG_ERR, "Failed malloc: %s.", errno);
+    long long now = tick_millis();
+    if (now < 0)
         return false;
+
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l) {
+        for (int s = 0; s < TIMERS_WHEEL_SLOTS; ++s)
+            list_init(&timers->slots[l][s]);
+        timers->occupied[l] = 0;
+    }
+    list_init(&timers->overflow);
+    timers->now = now;
+    timers->len = 0;
+    timers->catch_up_max = TIMERS_CATCH_UP_MAX;
+    timers->missed = 0;
+    timers->pool = NULL;
+    timers->events = NULL;
+
+    return true;
+}
+
+/**
+ * Places @t at the level of the highest 6-bit group in which its expiry
+ * differs from the wheel's time. Already expired timers go to the current
+ * slot.
+ */
+static void timers_insert(struct timers *timers, struct timer *t)
+{
+    long long expire = t->expire < timers->now ? timers->now : t->expire;
+    unsigned long long diff = expire ^ timers->now;
+    int level = 0;
+    if (diff >= TIMERS_WHEEL_SLOTS)
+        level = (63 - __builtin_clzll(diff)) / TIMERS_WHEEL_BITS;
+
+    if (level >= TIMERS_WHEEL_LEVELS) {
+        t->level = TIMERS_WHEEL_LEVELS;
+        t->slot = 0;
+        list_append(&timers->overflow, &t->item);
+        return;
     }
+
+    int slot = (expire >> TIMERS_LEVEL_SHIFT(level)) & TIMERS_WHEEL_MASK;
+    t->level = level;
+    t->slot = slot;
+    list_append(&timers->slots[level][slot], &t->item);
+    BITS_SET(timers->occupied[level], 1ULL << slot);
+}
+
+static void timers_unlink(struct timers *timers, struct timer *t)
+{
+    list_delete(&t->item);
+    if (t->level < TIMERS_WHEEL_LEVELS &&
+        list_is_empty(&timers->slots[t->level][t->slot]))
+        BITS_CLR(timers->occupied[t->level], 1ULL << t->slot);
+}
+
+static void timer_free(struct timers *timers, struct timer *t)
+{
+    if (t->event && t->event->self) {
+        free_event(timers->events, t->event->self);
+    }
+    if (t->self) {
+        timer_pool_put(timers->pool, t->self);
+    }
+}
+
+struct timer *set_timeout(struct timers *timers, long long delay, bool once,
+                          struct event *evt)
+{
+    struct timer *timer = timer_pool_get(timers->pool);
+    if (!timer)
+        return NULL;
     *timer = (struct timer){
         .name={0}, .once=once, .delay=delay,
         .event=evt, .self=timer
     };
     strcpy_safer(timer->name, evt->name, EVENT_NAME_MAX);
-    timer_init(timers, timer, 0);
-    return true;
+    if (!timer_init(timers, timer, 0)) {
+        timer_pool_put(timers->pool, timer);
+        return NULL;
+    }
+    return timer;
 }
 
 /**
  * @time optional: will be set to current time if 0.
  */
-bool timer_init(struct list_item *timers, struct timer *t, long long time)
+bool timer_init(struct timers *timers, struct timer *t, long long time)
 {
-    if (time == 0 && (time = now_millis()) < 0)
+    if (!t->once && t->delay <= 0) {
+        log_error("Periodic timer '%s' needs a positive delay.", t->name);
+        return false;
+    }
+    if (time == 0 && (time = tick_millis()) < 0)
         return false;
 
     t->expire = time + t->delay;
-    list_append(timers, &t->item);
+    timers_insert(timers, t);
+    timers->len++;
     log_debug("timer '%s' inited, expire=%lld", t->name, t->expire);
 
     return true;
 }
 
-bool timers_free_all(struct list_item *timers)
+bool timer_cancel(struct timers *timers, struct timer *t)
+{
+    if (!timer_is_pending(t))
+        return false;
+    log_debug("timer '%s' cancelled", t->name);
+    timers_unlink(timers, t);
+    timers->len--;
+    timer_free(timers, t);
+    return true;
+}
+
+static void timers_free_list(struct timers *timers, struct list_item *list)
+{
+    while (!list_is_empty(list)) {
+        struct timer *t = cont(list->prev, struct timer, item);
+        list_delete(list->prev);
+        timer_free(timers, t);
+    }
+}
+
+bool timers_free_all(struct timers *timers)
 {
     log_debug("Freeing remaining timers and events.");
-    while (!list_is_empty(timers)) {
-        struct timer *t = cont(timers->prev, struct timer, item);
-        list_delete(timers->prev);
-        if (t->event && t->event->self) {
-            free_event(t->event->self);
-        }
-        if (t->self) {
-            free(t->self);
-        }
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l) {
+        for (int s = 0; s < TIMERS_WHEEL_SLOTS; ++s)
+            timers_free_list(timers, &timers->slots[l][s]);
+        timers->occupied[l] = 0;
     }
+    timers_free_list(timers, &timers->overflow);
+    timers->len = 0;
     return true;
 }
 
-int timers_get_soonest(struct list_item *timers)
+/**
+ * Returns the earliest time, not before the wheel's time, at which a slot
+ * needs processing: expiry on level 0, cascade on upper levels. Returns -1 if
+ * the wheel is empty.
+ */
+static long long timers_next_slot(const struct timers *timers)
 {
-    long long tick = now_millis();
-    if (tick < 0)
-        return -1;
-    log_debug("tick=%lld", tick);
+    long long next = -1;
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l) {
+        int shift = TIMERS_LEVEL_SHIFT(l);
+        int cur = (timers->now >> shift) & TIMERS_WHEEL_MASK;
+        uint64_t ahead = timers->occupied[l] & (~0ULL << cur);
+        if (!ahead)
+            continue;
 
-    long long soonest = LLONG_MAX;
+        long long span = timers->now >> (shift + TIMERS_WHEEL_BITS);
+        long long t = (span << (shift + TIMERS_WHEEL_BITS))
+            | ((long long)__builtin_ctzll(ahead) << shift);
+        if (t < timers->now)
+            t = timers->now;
+        if (next < 0 || t < next)
+            next = t;
+    }
+
+    if (!list_is_empty(&timers->overflow)) {
+        long long t = (timers->now + TIMERS_RANGE_MASK) & ~TIMERS_RANGE_MASK;
+        if (next < 0 || t < next)
+            next = t;
+    }
 
-    struct list_item * it = timers;
-    list_for(it, timers) {
+    return next;
+}
+
+static long long timers_list_min_expire(const struct list_item *list)
+{
+    long long soonest = LLONG_MAX;
+    const struct list_item *it = list;
+    list_for(it, list) {
         const struct timer *t = cont(it, struct timer, item);
-        if (!t) {
-            log_error("Undefined container in list.");
-            return -2;
-        }
+        if (t->expire < soonest)
+            soonest = t->expire;
+    }
+    return soonest;
+}
 
-        if (t->expire - tick < soonest) {
-            soonest = t->expire - tick;
-        }
+/**
+ * Returns the earliest expiry, or -1 if the wheel is empty.
+ *
+ * Level 0 holds the current 64 ms, and each upper level's slots start after
+ * the span of the level below. So the earliest timer is in the first occupied
+ * slot of the lowest occupied level.
+ */
+static long long timers_next_expire(const struct timers *timers)
+{
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l) {
+        int cur = (timers->now >> TIMERS_LEVEL_SHIFT(l)) & TIMERS_WHEEL_MASK;
+        uint64_t ahead = timers->occupied[l] & (~0ULL << cur);
+        if (ahead)
+            return timers_list_min_expire(
+                &timers->slots[l][__builtin_ctzll(ahead)]);
     }
 
+    if (!list_is_empty(&timers->overflow))
+        return timers_list_min_expire(&timers->overflow);
+
+    return -1;
+}
+
+int timers_get_soonest(struct timers *timers)
+{
+    long long tick = tick_millis();
+    if (tick < 0)
+        return -1;
+    log_debug("tick=%lld", tick);
+
+    long long soonest = timers_next_expire(timers);
+    if (soonest < 0)
+        return -1;
+    // Timers armed after timers_apply() within the same ms expire on the
+    // wheel's next ms: don't spin until then.
+    if (soonest < timers->now)
+        soonest = timers->now;
+
+    soonest -= tick;
     if (soonest < 0) // some timers already expired
         soonest = 0;
-    else if (soonest == LLONG_MAX)
-        soonest = -1;
+    else if (soonest > INT_MAX)
+        soonest = INT_MAX;
 
     return soonest;
 }
 
-bool timers_apply(struct list_item *timers, event_queue *evq)
+static void timers_cascade(struct timers *timers, struct list_item *list)
 {
-    long long tack = now_millis();
-    if (tack < 0)
-        return false;
-    log_debug("tack=%lld", tack);
+    // Detach first, as overflowing timers may go back to the same list.
+    struct list_item pending = LIST_ITEM_INIT(pending);
+    while (!list_is_empty(list)) {
+        struct timer *t = cont(list->next, struct timer, item);
+        timers_unlink(timers, t);
+        list_append(&pending, &t->item);
+    }
+    while (!list_is_empty(&pending)) {
+        struct timer *t = cont(pending.next, struct timer, item);
+        list_delete(&t->item);
+        timers_insert(timers, t);
+    }
+}
+
+/**
+ * Processes the wheel's current ms: cascades upper slots starting there, then
+ * expires the level 0 slot.
+ */
+static unsigned int
+timers_process(struct timers *timers, event_queue *evq, long long tack)
+{
+    long long now = timers->now;
+
+    // From the top, so that timers can fall through several levels.
+    if ((now & TIMERS_RANGE_MASK) == 0)
+        timers_cascade(timers, &timers->overflow);
+    for (int l = TIMERS_WHEEL_LEVELS - 1; l > 0; --l) {
+        int shift = TIMERS_LEVEL_SHIFT(l);
+        if (now & ((1LL << shift) - 1))
+            continue;
+        int slot = (now >> shift) & TIMERS_WHEEL_MASK;
+        timers_cascade(timers, &timers->slots[l][slot]);
+    }
 
     unsigned int errors = 0;
-    struct list_item * it = timers;
-    list_for(it, timers) {
-        struct timer *t = cont(it, struct timer, item);
-        if (!t) {
-            log_error("Undefined container in list.");
-            return false;
-        }
+    struct list_item *expired = &timers->slots[0][now & TIMERS_WHEEL_MASK];
+    while (!list_is_empty(expired)) {
+        struct timer *t = cont(expired->next, struct timer, item);
+        timers_unlink(timers, t);
+        timers->len--;
 
-        int missed = 0;
-        while (t->expire <= tack) {
-            log_debug("timer '%s' triggered (missed=%ux)", t->name, missed);
+        if (t->once) {
+            log_debug("timer '%s' triggered", t->name);
             if (!event_queue_put(evq, t->event)) {
                 log_error("Enqueue event '%s' failed.", t->event->name);
                 errors++;
             }
-            /* FIXME handle `catch_up` flag: defaults to false, tells if we
-               need to fire the timer handler as many times as we missed,
-               in case the event loop lasted more than a timer period. */
-            if (t->once) {
-                it = it->prev; // deleting inside for_list
-                list_delete(&t->item);
-                if (t->self) {
-                    free(t->self);
-                }
-                break;
+            if (t->self) {
+                timer_pool_put(timers->pool, t->self);
             }
-            else {
-                t->expire += t->delay;
-                missed++;
+            continue;
+        }
+
+        /* Periods elapsed since @t->expire, which may be more than one if
+           the event loop lagged. Fired as many times (bounded) with
+           @catch_up, once otherwise: the others are counted as missed. */
+        unsigned long long periods = (tack - t->expire) / t->delay + 1;
+        unsigned long long fires = 1;
+        if (t->catch_up)
+            fires = periods < timers->catch_up_max ?
+                periods : timers->catch_up_max;
+        for (unsigned long long i = 0; i < fires; ++i) {
+            log_debug("timer '%s' triggered", t->name);
+            if (!event_queue_put(evq, t->event)) {
+                log_error("Enqueue event '%s' failed.", t->event->name);
+                errors++;
+                break;
             }
         }
+        if (periods > fires) {
+            log_debug("timer '%s' missed %llu periods", t->name,
+                      periods - fires);
+            t->missed += periods - fires;
+            timers->missed += periods - fires;
+        }
+        t->expire += periods * t->delay;
 
-    } // End for_list
+        timers_insert(timers, t);
+        timers->len++;
+    }
+
+    return errors;
+}
 
+/**
+ * Advances the wheel up to @tack included, jumping over empty slots.
+ */
+static bool timers_advance(struct timers *timers, event_queue *evq,
+                           long long tack)
+{
+    unsigned int errors = 0;
+    while (timers->now <= tack) {
+        long long next = timers_next_slot(timers);
+        if (next < 0 || next > tack) {
+            timers->now = tack + 1;
+            break;
+        }
+        timers->now = next;
+        errors += timers_process(timers, evq, tack);
+        timers->now++;
+    }
     return !errors;
 }
+
+bool timers_apply(struct timers *timers, event_queue *evq)
+{
+    long long tack = tick_millis();
+    if (tack < 0)
+        return false;
+    log_debug("tack=%lld", tack);
+
+    return timers_advance(timers, evq, tack);
+}
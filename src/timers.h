@@ -15,13 +15,31 @@
  * unfortunately.
  *
  * See also https://nodejs.org/en/docs/guides/event-loop-timers-and-nexttick/
+ *
+ * Timers are kept in a hierarchical timing wheel (Varghese & Lauck, "Hashed
+ * and Hierarchical Timing Wheels"), with millisecond resolution. Level 0 has
+ * one slot per ms, level 1 one slot per 64 ms, and so on. A timer is placed at
+ * the level of the highest 6-bit group in which its expiry differs from the
+ * wheel's current time, and is cascaded down to lower levels as time
+ * advances. Timers further than the wheel's range wait in an overflow list.
+ * So insertion and cancellation are O(1), and expiry is amortized O(1):
+ * occupancy bitmaps let us jump over empty slots.
  */
 #include <stdbool.h>
+#include <stdint.h>
 #include "events.h"
 #include "utils/list.h"
+#include "utils/pool.h"
 
 #define TIMER_NAME_MAX 64
 
+#define TIMERS_WHEEL_BITS   6
+#define TIMERS_WHEEL_SLOTS  (1 << TIMERS_WHEEL_BITS)
+#define TIMERS_WHEEL_LEVELS 6 // range of 2^36 ms, ~2 years
+/* Default bound on the firings of a @catch_up periodic timer in one go. */
+#define TIMERS_CATCH_UP_MAX 8
+#define TIMER_POOL_LEN 256
+
 /**
  * Timers may be periodic or once-only.
  *
@@ -34,6 +52,9 @@ struct timer {
     long long          delay;   // in ms,
     /* To compute when to trigger event (timeout). */
     long long          expire;  // timestamp for expiry
+    /* When a periodic timer lagged several periods behind (long event loop
+       iteration), fire once and skip to the next future period (default), or
+       fire once per missed period, up to @timers->catch_up_max. */
     bool               catch_up;
     bool               once;
     /* Address to self when allocated. @once timers are expected to be
@@ -44,14 +65,64 @@ struct timer {
        outside this struct. */
     struct timer      *self;
     struct event      *event;
+    /* Position in the wheel, TIMERS_WHEEL_LEVELS for overflow. */
+    unsigned char      level;
+    unsigned char      slot;
+    /* Periods skipped so far, for periodic timers. */
+    unsigned long long missed;
+};
+
+POOL_GENERATE(timer_pool, struct timer, TIMER_POOL_LEN)
+
+/**
+ * Initialize with timers_init().
+ */
+struct timers {
+    struct list_item slots[TIMERS_WHEEL_LEVELS][TIMERS_WHEEL_SLOTS];
+    uint64_t         occupied[TIMERS_WHEEL_LEVELS]; // bitmap of non-empty slots
+    struct list_item overflow;
+    /* Next ms to process: all timers expiring before have been applied. */
+    long long        now;
+    size_t           len;
+    /* Max firings of a @catch_up timer per expiry, >= 1. */
+    unsigned         catch_up_max;
+    /* Total periods skipped by periodic timers, for monitoring. */
+    unsigned long long missed;
+    /* Optional pools, owned by the loop, which allocated timers (@self) and
+       their allocated events are given back to. NULL for malloc(3). */
+    struct timer_pool *pool;
+    struct event_pool *events;
 };
 
-bool set_timeout(struct list_item *timers, long long delay, bool once, struct event *evt);
-bool timer_init(struct list_item *timers, struct timer *t, long long time);
-bool timers_free_all(struct list_item *timers);
+bool timers_init(struct timers *timers);
+/**
+ * Returns a handle to the allocated timer, or NULL on failure. The handle is
+ * only valid until the timer is triggered or cancelled.
+ */
+struct timer *set_timeout(struct timers *timers, long long delay, bool once, struct event *evt);
+bool timer_init(struct timers *timers, struct timer *t, long long time);
+
+/**
+ * A timer is pending until it's triggered (once) or cancelled. @t->item MUST
+ * have been initialized.
+ */
+static inline bool timer_is_pending(const struct timer *t)
+{
+    return !list_is_empty(&t->item);
+}
+
+/**
+ * Removes a pending timer in O(1). Allocated timers (@self) and their
+ * allocated event are freed.
+ *
+ * Returns false if @t wasn't pending, in which case its event may already be
+ * queued and nothing is freed.
+ */
+bool timer_cancel(struct timers *timers, struct timer *t);
+bool timers_free_all(struct timers *timers);
 /** Right before poll() to calculate its @timeout parameter. */
-int timers_get_soonest(struct list_item *timers);
+int timers_get_soonest(struct timers *timers);
 /** After poll() has returned. */
-bool timers_apply(struct list_item *timers, event_queue *evq);
+bool timers_apply(struct timers *timers, event_queue *evq);
 
 #endif /* TIMERS_H */
@@ -30,7 +30,8 @@
     GROWABLE_GENERATE_BASE(name, type)                                  \
     GROWABLE_GENERATE_INIT(name, type, cap_limit)                       \
     GROWABLE_GENERATE_GROW(name, type, sz_init, factor, cap_limit)      \
-    GROWABLE_GENERATE_RESET(name)
+    GROWABLE_GENERATE_RESET(name)                                       \
+    GROWABLE_GENERATE_CLEAR(name)
 
 #define GROWABLE_GENERATE(name, type, sz_init, factor, cap_limit)   \
     GROWABLE_GENERATE_BASIC(name, type, sz_init, factor, cap_limit) \
@@ -99,6 +100,15 @@ static inline void name##_reset(struct name *g)   \
     g->cap = 0;                                   \
 }
 
+#define GROWABLE_GENERATE_CLEAR(name)             \
+/**
+ * Empties the array but keeps its allocation, for reuse.
+ */                                               \
+static inline void name##_clear(struct name *g)   \
+{                                                 \
+    g->len  = 0;                                  \
+}
+
 #define GROWABLE_GENERATE_APPEND(name, type)                        \
 /**
  * Appends @len items from @data array to growable @g.
@@ -0,0 +1,87 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * A fixed-capacity pool of objects with a free-list.
+ *
+ * Objects are taken with _get() and given back with _put(), both O(1), so that
+ * short-lived objects don't cost a malloc(3)/free(3) pair each. When the pool
+ * is exhausted, _get() falls back to malloc(3), and _put() frees objects it
+ * doesn't own. A NULL pool thus simply means malloc(3).
+ *
+ * Use _init() before use. @used_max is the high-water mark of objects taken
+ * from the pool, @fallbacks the number of objects malloc'd because it was
+ * exhausted: if not 0, @len should be raised.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include "log.h"
+
+#define POOL_GENERATE(name, type, len)          \
+    POOL_GENERATE_BASE(name, type, len)         \
+    POOL_GENERATE_INIT(name, len)               \
+    POOL_GENERATE_OWNS(name, type, len)         \
+    POOL_GENERATE_GET(name, type)               \
+    POOL_GENERATE_PUT(name, type)
+
+#define POOL_GENERATE_BASE(name, type, len)     \
+    struct name {                               \
+        type               entries[len];        \
+        type              *free[len];           \
+        size_t             free_len;            \
+        size_t             used;                \
+        size_t             used_max;            \
+        unsigned long long fallbacks;           \
+    };
+
+#define POOL_GENERATE_INIT(name, len)                           \
+static inline void name##_init(struct name *p)                  \
+{                                                               \
+    for (size_t i = 0; i < len; ++i)                            \
+        p->free[i] = &p->entries[len - 1 - i];                  \
+    p->free_len = len;                                          \
+    p->used = 0;                                                \
+    p->used_max = 0;                                            \
+    p->fallbacks = 0;                                           \
+}
+
+#define POOL_GENERATE_OWNS(name, type, len)                             \
+static inline bool name##_owns(const struct name *p, const type *obj)   \
+{                                                                       \
+    return p && obj >= p->entries && obj < p->entries + len;            \
+}
+
+#define POOL_GENERATE_GET(name, type)                                   \
+/**
+ * Returns an uninitialized object, or NULL on failure.
+ */                                                                     \
+static inline type *name##_get(struct name *p)                          \
+{                                                                       \
+    if (p && p->free_len > 0) {                                         \
+        p->used++;                                                      \
+        if (p->used > p->used_max)                                      \
+            p->used_max = p->used;                                      \
+        return p->free[--p->free_len];                                  \
+    }                                                                   \
+    if (p)                                                              \
+        p->fallbacks++;                                                 \
+    type *obj = malloc(sizeof(type));                                   \
+    if (!obj)                                                           \
+        log_perror(LOG_ERR, "Failed malloc: %s.", errno);               \
+    return obj;                                                         \
+}
+
+#define POOL_GENERATE_PUT(name, type)                   \
+static inline void name##_put(struct name *p, type *obj)        \
+{                                                               \
+    if (!name##_owns(p, obj)) {                                 \
+        free(obj);                                              \
+        return;                                                 \
+    }                                                           \
+    p->used--;                                                  \
+    p->free[p->free_len++] = obj;                               \
+}
+
+
+#endif /* POOL_H */
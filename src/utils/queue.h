@@ -10,10 +10,17 @@
  *
  * Inspired from https://stackoverflow.com/a/13888143/421846.
  * Another cool implementation: http://www.martinbroadhurst.com/cirque-in-c.html.
+ *
+ * QUEUE_SPILL_GENERATE() makes a variant which doesn't fail when the ring is
+ * full, but spills into a growable array, up to @spill_max entries. The ring
+ * is thus the fast path, and bursts only cost a realloc(3) the first time.
+ * Once spilled, entries are put into the spill until it's drained, so that
+ * FIFO order is kept. Free the spill with _reset() after use.
  */
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include "utils/growable.h"
 
 enum queue_state {
     QUEUE_STATE_OK,
@@ -75,5 +82,74 @@ static inline enum queue_state name##_status(name *q)               \
         return QUEUE_STATE_OK;                                      \
 }
 
+#define QUEUE_SPILL_GENERATE(name, type, bit_len, spill_max)            \
+    QUEUE_GENERATE(name##_ring, type, bit_len)                          \
+    typedef type *name##_ptr;                                           \
+    GROWABLE_GENERATE(name##_spill, name##_ptr, QUEUE_BIT_LEN(bit_len), \
+                      2, spill_max)                                     \
+    typedef struct {                                                    \
+        name##_ring          ring;                                      \
+        struct name##_spill  spill;                                     \
+        size_t               spill_head; /* get */                      \
+        size_t               len;                                       \
+        size_t               len_max;                                   \
+        unsigned long long   spilled;                                   \
+    } name;                                                             \
+    QUEUE_GENERATE_INIT(name)                                           \
+    QUEUE_SPILL_GENERATE_PUT(name)                                      \
+    QUEUE_SPILL_GENERATE_GET(name, type)                                \
+    QUEUE_SPILL_GENERATE_STATUS(name, spill_max)                        \
+    QUEUE_SPILL_GENERATE_RESET(name)
+
+#define QUEUE_SPILL_GENERATE_PUT(name)                                  \
+static inline bool name##_put(name *q, void *elt)                       \
+{                                                                       \
+    if (q->spill.len > 0 || !name##_ring_put(&q->ring, elt)) {          \
+        name##_ptr ptr = elt;                                           \
+        if (!name##_spill_append(&q->spill, &ptr, 1))                   \
+            return false;                                               \
+        q->spilled++;                                                   \
+    }                                                                   \
+    if (++q->len > q->len_max)                                          \
+        q->len_max = q->len;                                            \
+    return true;                                                        \
+}
+
+/* Spilled entries are all younger than the ring's. */
+#define QUEUE_SPILL_GENERATE_GET(name, type)                            \
+static inline type *name##_get(name *q)                                 \
+{                                                                       \
+    type *elt = name##_ring_get(&q->ring);                              \
+    if (!elt) {                                                         \
+        if (q->spill_head == q->spill.len)                              \
+            return NULL;                                                \
+        elt = q->spill.buf[q->spill_head++];                            \
+        if (q->spill_head == q->spill.len) {                            \
+            name##_spill_clear(&q->spill);                              \
+            q->spill_head = 0;                                          \
+        }                                                               \
+    }                                                                   \
+    q->len--;                                                           \
+    return elt;                                                         \
+}
+
+#define QUEUE_SPILL_GENERATE_STATUS(name, spill_max)                    \
+static inline enum queue_state name##_status(name *q)                   \
+{                                                                       \
+    if (q->spill.len >= spill_max)                                      \
+        return QUEUE_STATE_FULL;                                        \
+    else if (q->len == 0)                                               \
+        return QUEUE_STATE_EMPTY;                                       \
+    else                                                                \
+        return QUEUE_STATE_OK;                                          \
+}
+
+#define QUEUE_SPILL_GENERATE_RESET(name)                                \
+static inline void name##_reset(name *q)                                \
+{                                                                       \
+    name##_spill_reset(&q->spill);                                      \
+    name##_init(q);                                                     \
+}
+
 
 #endif /* QUEUE_H */
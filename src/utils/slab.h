@@ -0,0 +1,143 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#ifndef SLAB_H
+#define SLAB_H
+
+/**
+ * A growable allocator of fixed-size objects.
+ *
+ * Objects are carved from slabs of @slab_len objects, malloc'd on demand and
+ * chained together. Freed objects go to a free-list, which _get() takes from
+ * first, so that objects cost a malloc(3) only once per slab. Unlike pools
+ * (utils/pool.h), slabs never run out, and all objects can be given back at
+ * once: _clear() keeps the slabs for reuse, _release() frees them.
+ *
+ * Use _init() before use. @used_max is the high-water mark of objects in use.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include "log.h"
+
+#define SLAB_GENERATE(name, type, slab_len)     \
+    SLAB_GENERATE_BASE(name, type, slab_len)    \
+    SLAB_GENERATE_INIT(name)                    \
+    SLAB_GENERATE_GROW(name, slab_len)          \
+    SLAB_GENERATE_GET(name, type)               \
+    SLAB_GENERATE_PUT(name, type)               \
+    SLAB_GENERATE_CLEAR(name)                   \
+    SLAB_GENERATE_RELEASE(name)
+
+#define SLAB_GENERATE_BASE(name, type, slab_len)        \
+    union name##_slot {                                 \
+        type               obj;                         \
+        union name##_slot *next;                        \
+    };                                                  \
+                                                        \
+    struct name##_chunk {                               \
+        struct name##_chunk *next;                      \
+        union name##_slot    slots[slab_len];           \
+    };                                                  \
+                                                        \
+    struct name {                                       \
+        struct name##_chunk *slabs;                     \
+        union name##_slot   *free;                      \
+        size_t               slabs_len;                 \
+        size_t               used;                      \
+        size_t               used_max;                  \
+    };
+
+#define SLAB_GENERATE_INIT(name)                        \
+static inline void name##_init(struct name *s)          \
+{                                                       \
+    s->slabs = NULL;                                    \
+    s->free = NULL;                                     \
+    s->slabs_len = 0;                                   \
+    s->used = 0;                                        \
+    s->used_max = 0;                                    \
+}
+
+#define SLAB_GENERATE_GROW(name, slab_len)                              \
+/**
+ * Pushes the slots of @slab onto the free-list, lowest address on top.
+ */                                                                     \
+static inline void name##_thread(struct name *s,                        \
+                                 struct name##_chunk *slab)             \
+{                                                                       \
+    for (size_t i = slab_len; i > 0; --i) {                             \
+        slab->slots[i-1].next = s->free;                                \
+        s->free = &slab->slots[i-1];                                    \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static inline bool name##_grow(struct name *s)                          \
+{                                                                       \
+    struct name##_chunk *slab = malloc(sizeof(struct name##_chunk));    \
+    if (!slab) {                                                        \
+        log_perror(LOG_ERR, "Failed malloc: %s.", errno);               \
+        return false;                                                   \
+    }                                                                   \
+    slab->next = s->slabs;                                              \
+    s->slabs = slab;                                                    \
+    s->slabs_len++;                                                     \
+    name##_thread(s, slab);                                             \
+    return true;                                                        \
+}
+
+#define SLAB_GENERATE_GET(name, type)                                   \
+/**
+ * Returns an uninitialized object, or NULL on failure.
+ */                                                                     \
+static inline type *name##_get(struct name *s)                          \
+{                                                                       \
+    if (!s->free && !name##_grow(s))                                    \
+        return NULL;                                                    \
+    union name##_slot *slot = s->free;                                  \
+    s->free = slot->next;                                               \
+    s->used++;                                                          \
+    if (s->used > s->used_max)                                          \
+        s->used_max = s->used;                                          \
+    return &slot->obj;                                                  \
+}
+
+#define SLAB_GENERATE_PUT(name, type)                                   \
+static inline void name##_put(struct name *s, type *obj)                \
+{                                                                       \
+    if (!obj)                                                           \
+        return;                                                         \
+    union name##_slot *slot = (union name##_slot *)obj;                 \
+    slot->next = s->free;                                               \
+    s->free = slot;                                                     \
+    s->used--;                                                          \
+}
+
+#define SLAB_GENERATE_CLEAR(name)                                       \
+/**
+ * Gives all objects back at once, keeping slabs for later use.
+ */                                                                     \
+static inline void name##_clear(struct name *s)                         \
+{                                                                       \
+    s->free = NULL;                                                     \
+    for (struct name##_chunk *slab = s->slabs; slab; slab = slab->next) \
+        name##_thread(s, slab);                                         \
+    s->used = 0;                                                        \
+}
+
+#define SLAB_GENERATE_RELEASE(name)                                     \
+/**
+ * Frees all slabs, thus all objects. The allocator can be reused.
+ */                                                                     \
+static inline void name##_release(struct name *s)                       \
+{                                                                       \
+    struct name##_chunk *slab = s->slabs;                               \
+    while (slab) {                                                      \
+        struct name##_chunk *next = slab->next;                         \
+        free(slab);                                                     \
+        slab = next;                                                    \
+    }                                                                   \
+    s->slabs = NULL;                                                    \
+    s->free = NULL;                                                     \
+    s->slabs_len = 0;                                                   \
+    s->used = 0;                                                        \
+}
+
+
+#endif /* SLAB_H */
@@ -4,6 +4,7 @@
 #include "utils/time.h"
 
 static clockid_t clockid = CLOCK_MONOTONIC;
+static long long tick = -1;
 
 static inline long long millis_from_timespec(struct timespec t) {
     return (t).tv_sec * 1000LL + (t).tv_nsec / 1e6;
@@ -47,3 +48,30 @@ bool now_sec(time_t *t)
     *t = tspec.tv_sec;
     return true;
 }
+
+long long tick_update()
+{
+    tick = now_millis();
+    return tick;
+}
+
+long long tick_millis()
+{
+    if (tick < 0)
+        return tick_update();
+    return tick;
+}
+
+void tick_set(long long ms)
+{
+    tick = ms;
+}
+
+bool tick_sec(time_t *t)
+{
+    long long ms = tick_millis();
+    if (ms < 0)
+        return false;
+    *t = ms / 1000;
+    return true;
+}
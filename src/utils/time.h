@@ -10,5 +10,23 @@ bool clock_res_is_millis();
 long long now_millis();
 bool now_sec(time_t *t);
 
+/**
+ * Cached monotonic clock for the event loop.
+ *
+ * Reading the clock is cheap but not free, and the loop needs the current time
+ * many times per iteration (timers, queries, routes). The loop thus updates the
+ * cached "tick" once before computing the poll timeout and once after poll
+ * returns. Time is then frozen for the rest of the iteration, so that all
+ * timestamps taken within one dispatch are consistent. Code that genuinely
+ * needs a fresh reading uses now_millis() directly.
+ */
+/** Reads the clock into the tick. Returns the new tick, or -1 on error. */
+long long tick_update();
+/** Returns the tick in ms, updated on first use, or -1 on error. */
+long long tick_millis();
+bool tick_sec(time_t *t);
+/** Sets the tick: simulations run on virtual time. */
+void tick_set(long long ms);
+
 
 #endif /* TIME_H */
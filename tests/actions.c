@@ -0,0 +1,89 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#define _GNU_SOURCE  // recvmmsg, from net/actions.c
+#include <assert.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+#include "net/actions.c"
+
+/**
+ * Connects a non-blocking TCP socket to @rx over loopback, and fills it up
+ * until it can't take more writes. Datagram destinations are ignored.
+ */
+static int tcp_filled(int *rx)
+{
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(lsock >= 0);
+    struct sockaddr_in sin = {0};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(lsock, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+    socklen_t len = sizeof(sin);
+    assert(getsockname(lsock, (struct sockaddr *)&sin, &len) == 0);
+    assert(listen(lsock, 1) == 0);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(sock >= 0);
+    assert(connect(sock, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+    *rx = accept(lsock, NULL, NULL);
+    assert(*rx >= 0);
+    close(lsock);
+
+    assert(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == 0);
+    char buf[DGRAM_BUFLEN] = {0};
+    while (send(sock, buf, sizeof(buf), 0) > 0);
+    assert(errno == EWOULDBLOCK || errno == EAGAIN);
+    return sock;
+}
+
+int main()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    int rx;
+    int sock = tcp_filled(&rx);
+    struct poller poller = {0};
+    assert(poller_init(&poller, POLLER_BACKEND_POLL, 1));
+    assert(poller_add(&poller, sock, POLLER_IN, NULL));
+    struct poller_event evs[1] = {0};
+    assert(poller_wait(&poller, evs, 0) == 0);
+
+    static struct dgram_queue sendq;
+    struct kad_ctx kctx = {.sendq = &sendq, .sock = sock};
+    struct sockaddr_storage addr = {0};
+    addr.ss_family = AF_INET;
+
+    // The queue gets blocked by kad_send() flushing it when full...
+    for (int i = 0; i < DGRAM_QUEUE_LEN; ++i)
+        assert(kad_send(&kctx, "x", 1, &addr));
+    assert(!sendq.blocked);
+    assert(!kad_send(&kctx, "x", 1, &addr));
+    assert(sendq.blocked && !sendq.out_armed);
+
+    // ...and the next flush still waits for writability.
+    assert(node_flush_data(&kctx, &poller));
+    assert(sendq.blocked && sendq.out_armed);
+    assert(dgram_queue_is_full(&sendq));
+    char buf[1 << 16];
+    while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+    assert(poller_wait(&poller, evs, 1000) == 1);
+    assert(evs[0].fd == sock && (evs[0].events & POLLER_OUT));
+
+    // Writable again: flushed, and writability not watched any more.
+    assert(node_flush_data(&kctx, &poller));
+    assert(!sendq.blocked && !sendq.out_armed);
+    assert(dgram_queue_is_empty(&sendq));
+    while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+    assert(poller_wait(&poller, evs, 0) == 0);
+
+    poller_terminate(&poller);
+    close(sock);
+    close(rx);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
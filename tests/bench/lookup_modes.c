@@ -0,0 +1,364 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+#include "net/actions.h"
+#include "net/kad/req_lru.h"
+#include "utils/time.h"
+#include "net/kad/routes.c"
+
+/* Compares lookup parallelism modes on a simulated network, in virtual time.
+
+   @len nodes with random ids each know all others, as much as their routing
+   table holds, and answer find_node right away, from their own table. Each
+   node has a fixed RTT, some never answer. The lookup initiator is a regular
+   kad_ctx, driven like the server loop: queued datagrams are handed to the
+   simulated nodes, and their responses delivered back after their RTT, then
+   timers and events are applied. The clock jumps to the next delivery or
+   timer. The network is the same for all modes (seeded). */
+
+#define BENCH_LOOKUPS 200
+#define BENCH_DEAD_PERCENT 10
+#define BENCH_RTT_MIN 10
+#define BENCH_RTT_MAX 200
+#define BENCH_PENDING_LEN DGRAM_QUEUE_LEN
+
+struct sim_node {
+    struct kad_routes   *routes;
+    kad_guid             id;
+    struct compact_addr  addr;
+    int                  rtt;
+    bool                 dead;
+};
+
+struct sim_response {
+    long long   at; // delivery time, 0 if free
+    struct dgram dgram;
+};
+
+struct sim {
+    struct sim_node     *nodes;
+    size_t               len;
+    kad_guid             self_id;
+    kad_guid             targets[BENCH_LOOKUPS];
+    struct sim_response  pending[BENCH_PENDING_LEN];
+    struct kad_ctx       remote; // answers for each simulated node in turn
+};
+
+struct sim_stats {
+    unsigned long long queries;
+    unsigned long long responses;
+    unsigned long long rounds;
+    long long          elapsed;
+    long long          to_closest; // for lookups which found the k closest
+    size_t             found;
+    size_t             lost;       // unanswered queries, timed out
+};
+
+/* Per-lookup state shared with the completion callback. */
+struct sim_lookup {
+    struct kad_node_info closest[KAD_K_CONST]; // truth
+    long long            started;
+    long long            found_at;             // -1 until found
+    bool                 done;
+    struct kad_lookup_stats stats;
+};
+
+static void random_id(kad_guid *id)
+{
+    for (int i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i)
+        id->bytes[i] = rand();
+    id->is_set = true;
+}
+
+static void sim_addr(struct compact_addr *addr, size_t i)
+{
+    *addr = (struct compact_addr){COMPACT_ADDR4_LEN,
+        {10, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, 0x1a, 0xe1}};
+}
+
+/** Returns the index of the node at @ss, or @sim->len. */
+static size_t sim_node_index(const struct sim *sim,
+                             const struct sockaddr_storage *ss)
+{
+    struct compact_addr addr;
+    if (!compact_addr_from_sockaddr(&addr, ss) || addr.bytes[0] != 10)
+        return sim->len;
+    size_t i = (size_t)addr.bytes[1] << 16 | (size_t)addr.bytes[2] << 8
+        | addr.bytes[3];
+    return i < sim->len ? i : sim->len;
+}
+
+/** Ids, RTTs and targets are drawn first, so that they don't depend on
+    random() calls of the lookups. */
+static void sim_init(struct sim *sim, size_t len)
+{
+    sim->len = len;
+    sim->nodes = calloc(len, sizeof(struct sim_node));
+    assert(sim->nodes);
+    srand(42);
+    random_id(&sim->self_id);
+    for (size_t i = 0; i < len; ++i) {
+        random_id(&sim->nodes[i].id);
+        sim_addr(&sim->nodes[i].addr, i);
+        sim->nodes[i].rtt = BENCH_RTT_MIN
+            + rand() % (BENCH_RTT_MAX - BENCH_RTT_MIN);
+        sim->nodes[i].dead = rand() % 100 < BENCH_DEAD_PERCENT;
+    }
+    for (size_t i = 0; i < BENCH_LOOKUPS; ++i)
+        random_id(&sim->targets[i]);
+}
+
+static struct kad_routes *sim_routes(const struct sim *sim, const kad_guid *id)
+{
+    struct kad_routes *routes = routes_new(true);
+    assert(routes);
+    routes->self_id = *id;
+    for (size_t i = 0; i < sim->len; ++i) {
+        if (kad_guid_eq(&sim->nodes[i].id, id))
+            continue;
+        struct kad_node_info info = {sim->nodes[i].id, sim->nodes[i].addr};
+        assert(routes_insert(routes, &info, 0));
+    }
+    return routes;
+}
+
+/** Fresh routing tables: nodes learn about the initiator while running. */
+static void sim_build(struct sim *sim)
+{
+    for (size_t i = 0; i < sim->len; ++i)
+        sim->nodes[i].routes = sim_routes(sim, &sim->nodes[i].id);
+    memset(sim->pending, 0, sizeof(sim->pending));
+}
+
+static void sim_destroy(struct sim *sim)
+{
+    for (size_t i = 0; i < sim->len; ++i)
+        routes_destroy(sim->nodes[i].routes);
+}
+
+/** The k closest live nodes to @target, by brute force. */
+static void sim_closest(const struct sim *sim, struct kad_node_info closest[],
+                        const kad_guid *target)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < sim->len; ++i) {
+        const kad_guid *id = &sim->nodes[i].id;
+        if (sim->nodes[i].dead)
+            continue;
+        size_t j = len;
+        if (len < KAD_K_CONST)
+            len++;
+        else if (kad_distance_cmp(target, id, &closest[--j].id) >= 0)
+            continue;
+        for (; j > 0 && kad_distance_cmp(target, id, &closest[j-1].id) < 0; --j)
+            closest[j] = closest[j-1];
+        closest[j] = (struct kad_node_info){*id, sim->nodes[i].addr};
+    }
+}
+
+static bool sim_found(const struct kad_node_info closest[],
+                      const struct kad_node_info nodes[], size_t nodes_len)
+{
+    if (nodes_len < KAD_K_CONST)
+        return false;
+    for (size_t i = 0; i < KAD_K_CONST; ++i)
+        if (!kad_guid_eq(&closest[i].id, &nodes[i].id))
+            return false;
+    return true;
+}
+
+static void lookup_done(const struct kad_lookup_result *result, void *data)
+{
+    struct sim_lookup *sl = data;
+    if (sl->found_at < 0 &&
+        sim_found(sl->closest, result->nodes, result->nodes_len))
+        sl->found_at = tick_millis();
+    sl->stats = result->stats;
+    sl->done = true;
+}
+
+/** Hands datagrams sent by @ctx to their node, which answers after its RTT. */
+static size_t sim_send(struct sim *sim, struct kad_ctx *ctx)
+{
+    size_t lost = 0;
+    struct dgram_queue *q = ctx->sendq;
+    for (; q->len > 0; q->head = (q->head + 1) % DGRAM_QUEUE_LEN, q->len--) {
+        const struct dgram *dg = &q->entries[q->head];
+        size_t i = sim_node_index(sim, &dg->addr);
+        assert(i < sim->len);
+        if (sim->nodes[i].dead) {
+            lost++;
+            continue;
+        }
+
+        struct sockaddr_storage from;
+        struct compact_addr self_addr;
+        sim_addr(&self_addr, 0xffffff);
+        assert(compact_addr_to_sockaddr(&from, &self_addr));
+        struct iobuf rsp = {0};
+        sim->remote.routes = sim->nodes[i].routes;
+        assert(kad_rpc_handle(&sim->remote, &from, dg->buf, dg->len, &rsp));
+
+        size_t p = 0;
+        while (p < BENCH_PENDING_LEN && sim->pending[p].at > 0)
+            p++;
+        assert(p < BENCH_PENDING_LEN);
+        assert(rsp.len <= DGRAM_BUFLEN);
+        struct sim_response *r = &sim->pending[p];
+        r->at = tick_millis() + sim->nodes[i].rtt;
+        r->dgram.addr = dg->addr;
+        r->dgram.len = rsp.len;
+        memcpy(r->dgram.buf, rsp.buf, rsp.len);
+        iobuf_reset(&rsp);
+    }
+    q->head = 0;
+    return lost;
+}
+
+/** Delivers responses due by now. */
+static void sim_deliver(struct sim *sim, struct kad_ctx *ctx)
+{
+    long long now = tick_millis();
+    for (size_t p = 0; p < BENCH_PENDING_LEN; ++p) {
+        struct sim_response *r = &sim->pending[p];
+        if (r->at == 0 || r->at > now)
+            continue;
+        struct iobuf rsp = {0};
+        kad_rpc_handle(ctx, &r->dgram.addr, r->dgram.buf, r->dgram.len, &rsp);
+        iobuf_reset(&rsp);
+        r->at = 0;
+    }
+}
+
+/** Returns the time of the next delivery, or -1. */
+static long long sim_next_delivery(const struct sim *sim)
+{
+    long long next = -1;
+    for (size_t p = 0; p < BENCH_PENDING_LEN; ++p) {
+        long long at = sim->pending[p].at;
+        if (at > 0 && (next < 0 || at < next))
+            next = at;
+    }
+    return next;
+}
+
+static void dispatch(struct timers *timers, event_queue *evq)
+{
+    assert(timers_apply(timers, evq));
+    while (event_queue_status(evq) != QUEUE_STATE_EMPTY) {
+        struct event *ev = event_queue_get(evq);
+        struct event *self = ev->self;
+        ev->cb(ev->args);
+        if (self)
+            free_event(timers->events, self);
+    }
+}
+
+static void bench(struct sim *sim, enum kad_lookup_par mode)
+{
+    static struct event_pool event_pool;
+    static struct timer_pool timer_pool;
+    event_pool_init(&event_pool);
+    timer_pool_init(&timer_pool);
+    tick_set(1000);
+    struct timers timers;
+    assert(timers_init(&timers));
+    timers.events = &event_pool;
+    timers.pool = &timer_pool;
+    event_queue evq;
+    event_queue_init(&evq);
+
+    struct kad_ctx ctx = {0};
+    ctx.timers = &timers;
+    ctx.sock = -1;
+    struct req_lru reqs_out = {0};
+    ctx.reqs_out = &reqs_out;
+    static struct dgram_queue sendq;
+    memset(&sendq, 0, sizeof(sendq));
+    ctx.sendq = &sendq;
+    assert(kad_rpc_init(&ctx, NULL) == 0);
+    srandom(42); // tx ids
+    routes_destroy(ctx.routes);
+    ctx.routes = sim_routes(sim, &sim->self_id);
+    ctx.lookups.mode = mode;
+    sim_build(sim);
+
+    struct sim_stats stats = {0};
+    for (size_t n = 0; n < BENCH_LOOKUPS; ++n) {
+        struct sim_lookup sl = {.started = tick_millis(), .found_at = -1};
+        sim_closest(sim, sl.closest, &sim->targets[n]);
+        assert(kad_lookup_start(&ctx, sim->targets[n], lookup_done, &sl));
+        unsigned id = ctx.lookups.last_id;
+
+        while (true) {
+            sim_deliver(sim, &ctx);
+            dispatch(&timers, &evq);
+            stats.lost += sim_send(sim, &ctx);
+
+            struct kad_lookup *lookup = kad_lookups_get(&ctx.lookups, id);
+            if (lookup && sl.found_at < 0 &&
+                sim_found(sl.closest, lookup->result.nodes,
+                          lookup->result.nodes_len))
+                sl.found_at = tick_millis();
+
+            if (sl.done)
+                break;
+            long long next = sim_next_delivery(sim);
+            int timeout = timers_get_soonest(&timers);
+            long long now = tick_millis();
+            if (timeout >= 0 && (next < 0 || now + timeout < next))
+                next = now + timeout;
+            assert(next > now); // stalled otherwise
+            tick_set(next);
+        }
+
+        stats.queries += sl.stats.queries;
+        stats.responses += sl.stats.responses;
+        stats.rounds += sl.stats.rounds;
+        stats.elapsed += sl.stats.elapsed;
+        if (sl.found_at >= 0) {
+            stats.found++;
+            stats.to_closest += sl.found_at - sl.started;
+        }
+    }
+
+    printf("  %-8s %8.1f %8.1f %6.1f %5zu%% %8lld ms %8lld ms %6.1f\n",
+           lookup_by_id(kad_lookup_par_names, mode),
+           (double)stats.queries / BENCH_LOOKUPS,
+           (double)stats.responses / BENCH_LOOKUPS,
+           (double)stats.rounds / BENCH_LOOKUPS,
+           stats.found * 100 / BENCH_LOOKUPS,
+           stats.found ? stats.to_closest / (long long)stats.found : -1,
+           stats.elapsed / BENCH_LOOKUPS,
+           (double)stats.lost / BENCH_LOOKUPS);
+
+    kad_rpc_terminate(&ctx, NULL);
+    sim_destroy(sim);
+}
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    const size_t lens[] = {500, 2000};
+    const enum kad_lookup_par modes[] = {
+        KAD_LOOKUP_PAR_STRICT, KAD_LOOKUP_PAR_BOUNDED, KAD_LOOKUP_PAR_LOOSE};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+        static struct sim sim;
+        sim_init(&sim, lens[i]);
+        printf("%6zu nodes (%d%% unresponsive, RTT %d..%d ms), %d lookups:\n",
+               lens[i], BENCH_DEAD_PERCENT, BENCH_RTT_MIN, BENCH_RTT_MAX,
+               BENCH_LOOKUPS);
+        printf("  %-8s %8s %8s %6s %6s %11s %11s %6s\n", "mode", "queries",
+               "answers", "rounds", "found", "to-closest", "elapsed", "lost");
+        for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); ++j)
+            bench(&sim, modes[j]);
+        free(sim.nodes);
+    }
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+#include "utils/heap.h"
+#include "net/kad/routes.c"
+
+/* Compares routes_find_closest() with the former full table scan, which is
+   replicated below. Tables are filled with @len nodes spread over all
+   buckets, so that the ones not fitting go to replacement caches. */
+
+#define BENCH_LOOKUPS 10000
+
+static double elapsed_ms(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1e3
+        + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static int candidate_heap_cmp(const struct candidate *a,
+                              const struct candidate *b)
+{
+    return candidate_cmp(a, b);
+}
+HEAP_GENERATE(candidate_heap, struct candidate*, KAD_K_CONST) // cppcheck-suppress ctunullpointer
+HEAP_GENERATE_REPLACE_TOP(candidate_heap, struct candidate*)
+
+/** Keeps the k closest nodes of all buckets in a max-heap. */
+static size_t scan_find_closest(struct kad_routes *routes,
+                                struct kad_node_info nodes[],
+                                const kad_guid *target, const kad_guid *caller)
+{
+    struct candidate candidates[KAD_K_CONST];
+    struct candidate *c = candidates;
+    struct candidate_heap sorted = {0};
+    candidate_heap_init(&sorted, KAD_K_CONST);
+
+    for (int i = routes->self_bucket; i < KAD_GUID_SPACE_IN_BITS; ++i) {
+        const struct kad_bucket *bucket = routes->buckets[i];
+        for (size_t j = 0; j < bucket->len; ++j) {
+            if (kad_guid_eq(caller, &bucket->ids[j]))
+                continue;
+            struct candidate tmp;
+            kad_distance(&tmp.dist, &bucket->ids[j], target);
+            tmp.node = bucket->nodes[j].info;
+            if (sorted.len < KAD_K_CONST) {
+                *c = tmp;
+                candidate_heap_push(&sorted, c++);
+            }
+            else if (candidate_cmp(&tmp, HEAP_PEEK(sorted)) < 0) {
+                c = HEAP_PEEK(sorted);
+                *c = tmp;
+                candidate_heap_replace_top(&sorted, c);
+            }
+        }
+    }
+
+    size_t nodes_len = sorted.len;
+    for (size_t i = nodes_len; i > 0; --i)
+        nodes[i-1] = candidate_heap_pop(&sorted)->node;
+    candidate_heap_reset(&sorted);
+
+    return nodes_len;
+}
+
+static void random_id(kad_guid *id)
+{
+    for (int i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i)
+        id->bytes[i] = rand();
+    id->is_set = true;
+}
+
+/** Random id of bucket @b: self's prefix, flipped bit @b, random suffix. */
+static void random_id_in_bucket(kad_guid *id, const kad_guid *self_id, int b)
+{
+    random_id(id);
+    for (int i = KAD_GUID_SPACE_IN_BITS - 1; i >= b; --i) {
+        int pos = KAD_GUID_SPACE_IN_BITS - 1 - i;
+        unsigned char mask = 0x80 >> (pos % CHAR_BIT);
+        id->bytes[pos / CHAR_BIT] &= ~mask;
+        if (kad_guid_bit(self_id, i) != (i == b))
+            id->bytes[pos / CHAR_BIT] |= mask;
+    }
+}
+
+static void bench(size_t len, kad_guid targets[])
+{
+    struct kad_routes *routes = routes_create();
+    assert(routes);
+    srand(42);
+    // Low buckets only have a few possible ids: duplicates are retried.
+    for (size_t i = 0; i < len;) {
+        struct kad_node_info info = {0};
+        random_id_in_bucket(&info.id, &routes->self_id,
+                            rand() % KAD_GUID_SPACE_IN_BITS);
+        if (routes_insert(routes, &info, 0))
+            i++;
+    }
+    size_t bucketed = 0;
+    for (int i = routes->self_bucket; i < KAD_GUID_SPACE_IN_BITS; ++i)
+        bucketed += routes->buckets[i]->len;
+
+    for (size_t i = 0; i < BENCH_LOOKUPS; ++i)
+        random_id(&targets[i]);
+
+    struct kad_node_info nodes[KAD_K_CONST];
+    struct kad_node_info ref[KAD_K_CONST];
+    for (size_t i = 0; i < 1000; ++i) {
+        size_t n = routes_find_closest(routes, nodes, &targets[i], NULL);
+        assert(n == scan_find_closest(routes, ref, &targets[i], NULL));
+        for (size_t j = 0; j < n; ++j)
+            assert(kad_guid_eq(&nodes[j].id, &ref[j].id));
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < BENCH_LOOKUPS; ++i)
+        scan_find_closest(routes, nodes, &targets[i], NULL);
+    double scan = elapsed_ms(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < BENCH_LOOKUPS; ++i)
+        routes_find_closest(routes, nodes, &targets[i], NULL);
+    double ordered = elapsed_ms(start);
+
+    printf("%6zu nodes (%4zu in buckets), %d lookups:\n", len, bucketed,
+           BENCH_LOOKUPS);
+    printf("  scan:    %9.3f ms\n", scan);
+    printf("  ordered: %9.3f ms\n", ordered);
+
+    routes_destroy(routes);
+}
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    kad_guid *targets = malloc(sizeof(kad_guid) * BENCH_LOOKUPS);
+    assert(targets);
+    const size_t lens[] = {100, 1000, 10000};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i)
+        bench(lens[i], targets);
+    free(targets);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
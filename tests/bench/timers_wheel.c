@@ -0,0 +1,136 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+#include "timers.c"
+
+/* Compares the timing wheel with the former timer list, which is replicated
+   below with an explicit time. Simulates a loop over 60s with @len query
+   timeouts spread over that period. */
+
+#define BENCH_SPAN_MILLIS 60000
+#define BENCH_STEP_MILLIS 60
+
+static double elapsed_ms(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1e3
+        + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static long long list_get_soonest(struct list_item *timers, long long tick)
+{
+    long long soonest = LLONG_MAX;
+    struct list_item *it = timers;
+    list_for(it, timers) {
+        const struct timer *t = cont(it, struct timer, item);
+        if (t->expire - tick < soonest)
+            soonest = t->expire - tick;
+    }
+    return soonest;
+}
+
+static bool list_apply(struct list_item *timers, event_queue *evq, long long tack)
+{
+    unsigned int errors = 0;
+    struct list_item *it = timers;
+    list_for(it, timers) {
+        struct timer *t = cont(it, struct timer, item);
+        while (t->expire <= tack) {
+            if (!event_queue_put(evq, t->event))
+                errors++;
+            if (t->once) {
+                it = it->prev;
+                list_delete(&t->item);
+                break;
+            }
+            t->expire += t->delay;
+        }
+    }
+    return !errors;
+}
+
+static void drain(event_queue *evq)
+{
+    while (event_queue_get(evq));
+}
+
+static void bench(struct timer tms[], size_t len, struct event *ev)
+{
+    event_queue evq = {0};
+    long long base = 1 << 20;
+    srand(42);
+    for (size_t i = 0; i < len; ++i)
+        tms[i] = (struct timer){
+            .name="t", .delay=1 + rand() % BENCH_SPAN_MILLIS, .once=true,
+            .event=ev
+        };
+
+    struct list_item list = LIST_ITEM_INIT(list);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < len; ++i) {
+        tms[i].expire = base + tms[i].delay;
+        list_append(&list, &tms[i].item);
+    }
+    double list_insert = elapsed_ms(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long long tick = base; tick <= base + BENCH_SPAN_MILLIS;
+         tick += BENCH_STEP_MILLIS) {
+        list_get_soonest(&list, tick);
+        assert(list_apply(&list, &evq, tick));
+        drain(&evq);
+    }
+    double list_loop = elapsed_ms(start);
+    assert(list_is_empty(&list));
+
+    struct timers w;
+    assert(timers_init(&w));
+    w.now = base;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < len; ++i)
+        assert(timer_init(&w, &tms[i], base));
+    double wheel_insert = elapsed_ms(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long long tick = base; tick <= base + BENCH_SPAN_MILLIS;
+         tick += BENCH_STEP_MILLIS) {
+        timers_next_expire(&w);
+        assert(timers_advance(&w, &evq, tick));
+        drain(&evq);
+    }
+    double wheel_loop = elapsed_ms(start);
+    assert(w.len == 0);
+
+    for (size_t i = 0; i < len; ++i)
+        assert(timer_init(&w, &tms[i], base));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < len; ++i)
+        timer_cancel(&w, &tms[i]);
+    double wheel_cancel = elapsed_ms(start);
+    assert(w.len == 0);
+
+    printf("%7zu timers, %d iterations:\n", len,
+           BENCH_SPAN_MILLIS / BENCH_STEP_MILLIS + 1);
+    printf("  list:  insert %9.3f ms, loop %9.3f ms\n", list_insert, list_loop);
+    printf("  wheel: insert %9.3f ms, loop %9.3f ms, cancel %9.3f ms\n",
+           wheel_insert, wheel_loop, wheel_cancel);
+}
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    static struct event ev = {"ev", .cb=NULL, .args={{{0}}}, .fatal=false};
+    const size_t lens[] = {10000, 100000};
+    struct timer *tms = malloc(sizeof(struct timer) * lens[1]);
+    assert(tms);
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i)
+        bench(tms, lens[i], &ev);
+    free(tms);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
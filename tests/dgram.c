@@ -0,0 +1,79 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+#include "net/dgram.h"
+
+static int udp_bound(struct sockaddr_storage *addr)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(sock >= 0);
+    struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+    memset(addr, 0, sizeof(*addr));
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(sock, (struct sockaddr *)sin, sizeof(*sin)) == 0);
+    socklen_t len = sizeof(*addr);
+    assert(getsockname(sock, (struct sockaddr *)addr, &len) == 0);
+    return sock;
+}
+
+int main()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    struct sockaddr_storage addr_tx, addr_rx;
+    int tx = udp_bound(&addr_tx);
+    int rx = udp_bound(&addr_rx);
+
+    static struct dgram_queue q = {0};
+    assert(dgram_queue_is_empty(&q));
+    assert(dgram_queue_flush(&q, tx) == 0);
+    assert(q.flushes == 0);
+
+    char big[DGRAM_BUFLEN + 1] = {0};
+    assert(!dgram_queue_put(&q, big, sizeof(big), &addr_rx));
+    assert(q.dropped == 1);
+
+    // Wrap around the ring
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < DGRAM_QUEUE_LEN; ++i) {
+            char c = 'a' + i % 26;
+            assert(dgram_queue_put(&q, &c, 1, &addr_rx));
+        }
+        assert(dgram_queue_is_full(&q));
+        char c = 'z';
+        assert(!dgram_queue_put(&q, &c, 1, &addr_rx));
+
+        assert(dgram_queue_flush(&q, tx) == DGRAM_QUEUE_LEN);
+        assert(dgram_queue_is_empty(&q));
+        assert(!q.blocked);
+
+        for (int i = 0; i < DGRAM_QUEUE_LEN; ++i) {
+            char buf[8];
+            assert(recv(rx, buf, sizeof(buf), 0) == 1);
+            assert(buf[0] == 'a' + i % 26);
+        }
+
+        // Misalign head for next round
+        assert(dgram_queue_put(&q, "xyz", 3, &addr_rx));
+        assert(dgram_queue_flush(&q, tx) == 1);
+        char buf[8];
+        assert(recv(rx, buf, sizeof(buf), 0) == 3);
+        assert(memcmp(buf, "xyz", 3) == 0);
+    }
+    assert(q.sent == 3 * (DGRAM_QUEUE_LEN + 1));
+    assert(q.flushes == 6);
+    assert(q.dropped == 4);
+    assert(q.len_max == DGRAM_QUEUE_LEN);
+
+    close(tx);
+    close(rx);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
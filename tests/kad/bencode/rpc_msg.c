@@ -97,14 +97,11 @@ int main ()
     assert(kad_guid_eq(&msg.node_id, &(kad_guid){.bytes = "0123456789abcdefghij", .is_set = true}));
     assert(msg.nodes_len == 2);
     assert(kad_guid_eq(&msg.nodes[0].id, &(kad_guid){.bytes = "abcdefghij0123456789", .is_set = true}));
-    struct sockaddr_storage ss = {0};
-    struct sockaddr_in *sa = (struct sockaddr_in*)&ss;
-    sa->sin_family=AF_INET; sa->sin_addr.s_addr=htonl(0xc0a8a80f); sa->sin_port=htons(0x2f58);
-    assert(sockaddr_storage_eq(&msg.nodes[0].addr, &ss));
+    assert(compact_addr_eq(&msg.nodes[0].addr, &(struct compact_addr){
+                COMPACT_ADDR4_LEN, {0xc0, 0xa8, 0xa8, 0x0f, 0x2f, 0x58}}));
     assert(kad_guid_eq(&msg.nodes[1].id, &(kad_guid){.bytes = "mnopqrstuvwxyz123456", .is_set = true}));
-    memset(&ss, 0, sizeof(ss));
-    sa->sin_family=AF_INET; sa->sin_addr.s_addr=htonl(0xc0a8a819); sa->sin_port=htons(0x2f59);
-    assert(sockaddr_storage_eq(&msg.nodes[1].addr, &ss));
+    assert(compact_addr_eq(&msg.nodes[1].addr, &(struct compact_addr){
+                COMPACT_ADDR4_LEN, {0xc0, 0xa8, 0xa8, 0x19, 0x2f, 0x59}}));
 
     strcpy(buf, KAD_TEST_FIND_NODE_RESPONSE_IP6);
     memset(&msg, 0, sizeof(msg));
@@ -115,16 +112,11 @@ int main ()
     assert(kad_guid_eq(&msg.node_id, &(kad_guid){.bytes = "0123456789abcdefghij", .is_set = true}));
     assert(msg.nodes_len == 2);
     assert(kad_guid_eq(&msg.nodes[0].id, &(kad_guid){.bytes = "abcdefghij0123456789", .is_set = true}));
-    memset(&ss, 0, sizeof(ss));
-    struct sockaddr_in6 *sa6 = (struct sockaddr_in6*)&ss;
-    sa6->sin6_family=AF_INET6; sa6->sin6_port=htons(0x0203);
-    memcpy(sa6->sin6_addr.s6_addr, (unsigned char[]){1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1}, sizeof(struct in6_addr));
-    assert(sockaddr_storage_eq(&msg.nodes[0].addr, &ss));
+    assert(compact_addr_eq(&msg.nodes[0].addr, &(struct compact_addr){
+                COMPACT_ADDR6_LEN, {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, 0x02, 0x03}}));
     assert(kad_guid_eq(&msg.nodes[1].id, &(kad_guid){.bytes = "mnopqrstuvwxyz123456", .is_set = true}));
-    memset(&ss, 0, sizeof(ss));
-    sa6->sin6_family=AF_INET6; sa6->sin6_port=htons(0x0304);
-    memcpy(sa6->sin6_addr.s6_addr, (unsigned char[]){1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0xaa}, sizeof(struct in6_addr));
-    assert(sockaddr_storage_eq(&msg.nodes[1].addr, &ss));
+    assert(compact_addr_eq(&msg.nodes[1].addr, &(struct compact_addr){
+                COMPACT_ADDR6_LEN, {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0xaa, 0x03, 0x04}}));
 
     strcpy(buf, KAD_TEST_FIND_NODE_RESPONSE_BOGUS);
     memset(&msg, 0, sizeof(msg));
@@ -192,16 +184,12 @@ int main ()
     msg.type = KAD_RPC_TYPE_RESPONSE;
     msg.meth = KAD_RPC_METH_FIND_NODE;
     msg.node_id = (kad_guid){.bytes = "0123456789abcdefghij"};
-    memset(&ss, 0, sizeof(ss));
     msg.nodes[0] = (struct kad_node_info){
-        .id = {.bytes = "abcdefghij0123456789"}, {0}, {0}};
-    sa->sin_family=AF_INET; sa->sin_port=htons(0x2f58);
-    sa->sin_addr.s_addr=htonl(0xc0a8a80f); sa->sin_port=htons(0x2f58);
-    msg.nodes[0].addr = ss;
+        .id = {.bytes = "abcdefghij0123456789"},
+        .addr = {COMPACT_ADDR4_LEN, {0xc0, 0xa8, 0xa8, 0x0f, 0x2f, 0x58}}};
     msg.nodes[1] = (struct kad_node_info){
-        .id = {.bytes = "mnopqrstuvwxyz123456"}, {0}, {0}};
-    sa->sin_addr.s_addr=htonl(0xc0a8a819); sa->sin_port=htons(0x2f59);
-    msg.nodes[1].addr = ss;
+        .id = {.bytes = "mnopqrstuvwxyz123456"},
+        .addr = {COMPACT_ADDR4_LEN, {0xc0, 0xa8, 0xa8, 0x19, 0x2f, 0x59}}};
     msg.nodes_len = 2;
     assert(check_encoded_msg(&msg, &msgbuf, "d1:rd2:id20:0123456789abcdefghij5:nodesl"
                              "26:abcdefghij0123456789\xc0\xa8\xa8\x0f\x2f\x58"
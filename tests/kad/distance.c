@@ -0,0 +1,85 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <stdlib.h>
+#include "net/kad/distance.h"
+
+/* Word-wise kernels checked against byte-wise references. */
+
+static int ref_distance_cmp(const kad_guid *target, const kad_guid *a,
+                            const kad_guid *b)
+{
+    for (size_t i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i) {
+        unsigned char xa = a->bytes[i] ^ target->bytes[i];
+        unsigned char xb = b->bytes[i] ^ target->bytes[i];
+        if (xa != xb)
+            return xa < xb ? -1 : 1;
+    }
+    return 0;
+}
+
+static int ref_clz(const kad_guid *a, const kad_guid *b)
+{
+    int lz = 0;
+    for (size_t i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i) {
+        unsigned char x = a->bytes[i] ^ b->bytes[i];
+        lz += clz(x);
+        if (x)
+            return lz;
+    }
+    return KAD_ID_WORDS * KAD_ID_WORD_BITS;
+}
+
+static int sign(int n)
+{
+    return (n > 0) - (n < 0);
+}
+
+static void random_id(kad_guid *id)
+{
+    for (size_t i = 0; i < KAD_GUID_SPACE_IN_BYTES; ++i)
+        id->bytes[i] = rand();
+    id->is_set = true;
+}
+
+int main ()
+{
+    kad_guid zero = {.bytes = {0}, .is_set = true};
+    kad_guid last = {.bytes = {[KAD_GUID_SPACE_IN_BYTES-1] = 0x01}, .is_set = true};
+    kad_guid first = {.bytes = {[0] = 0x80}, .is_set = true};
+
+    assert(kad_id_word(last.bytes, KAD_ID_WORDS - 1) != 0);
+    assert(kad_id_word(first.bytes, 0) == 1ULL << 63);
+    assert(kad_distance_clz(&zero, &zero) == KAD_ID_WORDS * KAD_ID_WORD_BITS);
+    assert(kad_distance_clz(&zero, &first) == 0);
+    assert(kad_distance_clz(&zero, &last) == KAD_GUID_SPACE_IN_BITS - 1);
+    assert(kad_id_cmp(&zero, &last) < 0);
+    assert(kad_id_cmp(&first, &last) > 0);
+    assert(kad_id_cmp(&first, &first) == 0);
+    assert(kad_distance_cmp(&zero, &last, &first) < 0);
+    assert(kad_distance_cmp(&first, &last, &first) > 0);
+    assert(kad_distance_cmp(&first, &last, &last) == 0);
+
+    srand(42);
+    for (int n = 0; n < 100000; ++n) {
+        kad_guid target, a, b;
+        random_id(&target);
+        random_id(&a);
+        random_id(&b);
+        // Also exercise long common prefixes.
+        size_t common = rand() % KAD_GUID_SPACE_IN_BYTES;
+        memcpy(b.bytes, a.bytes, common);
+
+        assert(sign(kad_distance_cmp(&target, &a, &b))
+               == ref_distance_cmp(&target, &a, &b));
+        assert(kad_distance_clz(&a, &b) == ref_clz(&a, &b));
+
+        kad_guid d, ref;
+        kad_distance(&d, &a, &b);
+        kad_guid_xor(&ref, &a, &b);
+        assert(memcmp(d.bytes, ref.bytes, KAD_GUID_SPACE_IN_BYTES) == 0);
+        assert(sign(kad_id_cmp(&a, &b))
+               == sign(memcmp(a.bytes, b.bytes, KAD_GUID_SPACE_IN_BYTES)));
+    }
+
+    return 0;
+}
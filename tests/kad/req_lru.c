@@ -48,6 +48,7 @@ int main()
     assert(req_lru_put(&reqs_out, q, &evicted));
     assert(evicted);
     assert(evicted == oldest);
+    assert(reqs_out.len == REQ_LRU_CAPACITY);
     free(evicted);
 
     while (!list_is_empty(&reqs_out.litems)) {
@@ -77,7 +77,9 @@
 int main ()
 {
     assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
-    struct kad_routes *routes = routes_create();
+    // Expected buckets assume all are allocated.
+    struct kad_routes *routes = routes_new(false);
+    kad_generate_id(&routes->self_id);
 
     routes->self_id.bytes[0] = 0b10100000 /* 0xa0 */;
     char *id = log_fmt_hex_dyn(LOG_DEBUG, routes->self_id.bytes, KAD_GUID_SPACE_IN_BYTES);
@@ -91,11 +93,11 @@ int main ()
     } peers[] = {
         // Only using first 4 bits (KAD_GUID_SPACE_IN_BITS=4)
         //  0b10100000 /* 0xa0 */ self
-        {{{{0b00010000 /* 0x10 */}, true}, {0}, {0}}, 0b0011 /* 3 */},
-        {{{{0b10110000 /* 0xb0 */}, true}, {0}, {0}}, 0b0000 /* 0 */},
-        {{{{0b10000000 /* 0x80 */}, true}, {0}, {0}}, 0b0001 /* 1 */},
-        {{{{0b11010000 /* 0xd0 */}, true}, {0}, {0}}, 0b0010 /* 2 */},
-        {{{{0b01110000 /* 0x70 */}, true}, {0}, {0}}, 0b0011 /* 3 */},
+        {{{{0b00010000 /* 0x10 */}, true}, {0}}, 0b0011 /* 3 */},
+        {{{{0b10110000 /* 0xb0 */}, true}, {0}}, 0b0000 /* 0 */},
+        {{{{0b10000000 /* 0x80 */}, true}, {0}}, 0b0001 /* 1 */},
+        {{{{0b11010000 /* 0xd0 */}, true}, {0}}, 0b0010 /* 2 */},
+        {{{{0b01110000 /* 0x70 */}, true}, {0}}, 0b0011 /* 3 */},
     };
 
     assert(kad_bucket_hash(
@@ -103,26 +105,18 @@ int main ()
                &(kad_guid){.bytes = {0}, .is_set = true})
            == 0);
 
-    struct sockaddr_storage ss = {0};
-    struct sockaddr_in *sa = (struct sockaddr_in*)&ss;
-    sa->sin_family=AF_INET; sa->sin_port=htons(0x0016);
-    sa->sin_addr.s_addr=htonl(0x01010101); peers[0].info.addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010200); peers[1].info.addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010201); peers[2].info.addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010202); peers[3].info.addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010203); peers[4].info.addr = ss;
+    for (int i = 0; i < 5; ++i)
+        peers[i].info.addr = (struct compact_addr){
+            COMPACT_ADDR4_LEN, {1, 1, i == 0 ? 1 : 2, i == 0 ? 1 : i - 1, 0, 0x16}};
 
     struct peer_test *peer = peers;
     const struct peer_test *peer_end = peers + ARRAY_LEN(peers);
     while (peer < peer_end) {
-        assert(sockaddr_storage_fmt(peer->info.addr_str, &peer->info.addr));
-
         assert(routes_insert(routes, &peer->info, 0));
 
         struct kad_node_info bucket[KAD_K_CONST];
-        int bucket_len = kad_bucket_get_nodes(&routes->buckets[peer->bucket], bucket, 0, KAD_K_CONST, NULL);
-        /* printf("%s == %s\n", peer->info.addr_str, bucket[bucket_len-1].addr_str); */
-        assert(sockaddr_storage_eq(&peer->info.addr, &bucket[bucket_len-1].addr));
+        int bucket_len = kad_bucket_get_nodes(routes->buckets[peer->bucket], bucket, 0, KAD_K_CONST, NULL);
+        assert(compact_addr_eq(&peer->info.addr, &bucket[bucket_len-1].addr));
 
         peer++;
     }
@@ -134,38 +128,38 @@ int main ()
     /* printf("added=%zul\n", added); */
     assert(added == 5);
 
-    int peer_order[KAD_K_CONST] = {4, 0, 3, 1, 2, 0};
+    int peer_order[KAD_K_CONST] = {2, 1, 3, 0, 4, 0};
     for (size_t i = 0; i < added; ++i) {
-        assert(sockaddr_storage_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
+        assert(compact_addr_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
     }
 
     kad_guid_set(&target, (unsigned char[]){0xc0 /* 0b1100 */});
     added = routes_find_closest(routes, nodes, &target, NULL);
     assert(added == 5);
-    memcpy(peer_order, (int[]){0, 4, 1, 2, 3, 0}, sizeof(peer_order));
+    memcpy(peer_order, (int[]){3, 2, 1, 4, 0, 0}, sizeof(peer_order));
     for (size_t i = 0; i < added; ++i) {
-        assert(sockaddr_storage_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
+        assert(compact_addr_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
     }
 
     kad_guid_set(&target, (unsigned char[]){0x03 /* 0b0011 */});
     added = routes_find_closest(routes, nodes, &target, NULL);
     assert(added == 5);
-    memcpy(peer_order, (int[]){3, 1, 2, 4, 0, 0}, sizeof(peer_order));
+    memcpy(peer_order, (int[]){0, 4, 2, 1, 3, 0}, sizeof(peer_order));
     for (size_t i = 0; i < added; ++i) {
-        assert(sockaddr_storage_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
+        assert(compact_addr_eq(&nodes[i].addr, &peers[peer_order[i]].info.addr));
     }
 
     // Known nodes > KAD_K_CONST
     struct kad_node_info peers8[] = {
         //  0b10100000 /* 0xa0 */ self
-        {{{0b00010000 /* 0x10 */}, true}, {0}, {0}},
-        {{{0b00110000 /* 0x30 */}, true}, {0}, {0}},
-        {{{0b01000000 /* 0x40 */}, true}, {0}, {0}},
-        {{{0b01110000 /* 0x70 */}, true}, {0}, {0}},
-        {{{0b10000000 /* 0x80 */}, true}, {0}, {0}},
-        {{{0b10010000 /* 0x90 */}, true}, {0}, {0}},
-        {{{0b10110000 /* 0xb0 */}, true}, {0}, {0}},
-        {{{0b11010000 /* 0xd0 */}, true}, {0}, {0}},
+        {{{0b00010000 /* 0x10 */}, true}, {0}},
+        {{{0b00110000 /* 0x30 */}, true}, {0}},
+        {{{0b01000000 /* 0x40 */}, true}, {0}},
+        {{{0b01110000 /* 0x70 */}, true}, {0}},
+        {{{0b10000000 /* 0x80 */}, true}, {0}},
+        {{{0b10010000 /* 0x90 */}, true}, {0}},
+        {{{0b10110000 /* 0xb0 */}, true}, {0}},
+        {{{0b11010000 /* 0xd0 */}, true}, {0}},
     };
 
     for (struct peer_test *p = peers; p != peers + ARRAY_LEN(peers); ++p) {
@@ -180,7 +174,7 @@ int main ()
     added = routes_find_closest(routes, nodes, &target, NULL);
     assert(added == 6);
 
-    memcpy(peer_order, (int[]){7, 2, 3, 5, 4, 6}, sizeof(peer_order));
+    memcpy(peer_order, (int[]){7, 6, 4, 5, 3, 2}, sizeof(peer_order));
     for (size_t i = 0; i < added; ++i) {
         LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES); // cppcheck-suppress shadowVariable
         log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, nodes[i].id.bytes);
@@ -193,7 +187,7 @@ int main ()
     added = routes_find_closest(routes, nodes, &target, &peers8[4].id /* 0x80 */);
     assert(added == 6);
 
-    memcpy(peer_order, (int[]){1, 2, 3, 5, 6, 7}, sizeof(peer_order));
+    memcpy(peer_order, (int[]){7, 6, 5, 3, 2, 1}, sizeof(peer_order));
     for (size_t i = 0; i < added; ++i) {
         LOG_FMT_HEX_DECL(id, KAD_GUID_SPACE_IN_BYTES); // cppcheck-suppress shadowVariable
         log_fmt_hex(id, KAD_GUID_SPACE_IN_BYTES, nodes[i].id.bytes);
@@ -4,13 +4,23 @@
 #include "log.h"
 #include "kad/test_util.h"
 #include "net/kad/req_lru.h"
+#include "net/actions.h"
 #include "net/kad/rpc.c"
 
+static struct kad_lookup_result lookup_result;
+
+static void lookup_done(const struct kad_lookup_result *result, void *data)
+{
+    lookup_result = *result;
+    *(int *)data += 1;
+}
+
 int main ()
 {
     assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
     struct kad_ctx ctx = {0};
-    struct list_item timers = LIST_ITEM_INIT(timers);
+    struct timers timers;
+    assert(timers_init(&timers));
     ctx.timers = &timers;
     struct req_lru reqs_out = {0};
     ctx.reqs_out = &reqs_out;
@@ -37,6 +47,169 @@ int main ()
                &(struct kad_node_lookup){.target = {.bytes = {[0]=0, [1]=0xff}},
                        .id = {.bytes = {[0]=0, [1]=1}}}));
 
+    // Equally close (distances fe and f1): the fastest ranks first.
+    struct kad_node_lookup fast = {.target = {.bytes = {[0]=0, [1]=0xff}},
+                                   .id = {.bytes = {[0]=0, [1]=0x01}}, .rtt = 10};
+    struct kad_node_lookup slow = {.target = {.bytes = {[0]=0, [1]=0xff}},
+                                   .id = {.bytes = {[0]=0, [1]=0x0e}}, .rtt = 50};
+    assert(0 < node_heap_cmp(&fast, &slow));
+    slow.rtt = ROUTES_RTT_UNKNOWN;
+    assert(0 < node_heap_cmp(&fast, &slow));
+    fast.rtt = ROUTES_RTT_UNKNOWN;
+    assert(0 < node_heap_cmp(&slow, &fast));
+    // Not as close (distance 1ff): distance first.
+    struct kad_node_lookup far = {.target = {.bytes = {[0]=0, [1]=0xff}},
+                                  .id = {.bytes = {[0]=1, [1]=0}}, .rtt = 1};
+    assert(0 < node_heap_cmp(&slow, &far));
+
+    struct kad_node_info ranked[3] = {
+        {.id = slow.id}, {.id = fast.id}, {.id = far.id}};
+    int rtts[3] = {50, 10, 1};
+    kad_lookup_rank_nodes(ranked, rtts, 3, &fast.target);
+    assert(kad_guid_eq(&ranked[0].id, &fast.id) && rtts[0] == 10);
+    assert(kad_guid_eq(&ranked[1].id, &slow.id) && rtts[1] == 50);
+    assert(kad_guid_eq(&ranked[2].id, &far.id) && rtts[2] == 1);
+
+
+    // RTT estimator
+
+    struct kad_rtt_est est = {0};
+    assert(kad_rtt_est_timeout(&est) == KAD_RPC_RTO_INIT_MILLIS);
+    kad_rtt_est_sample(&est, -1);
+    assert(est.samples == 0);
+    kad_rtt_est_sample(&est, 100);
+    assert(est.srtt == 100 * 8 && est.rttvar == 50 * 8);
+    assert(kad_rtt_est_timeout(&est) == 300);
+    for (int i = 0; i < 100; ++i)
+        kad_rtt_est_sample(&est, 100);
+    assert(est.srtt == 100 * 8 && est.rttvar < 8);
+    assert(kad_rtt_est_timeout(&est) == 150); // slightly slower nodes still make it
+    for (int i = 0; i < 100; ++i)
+        kad_rtt_est_sample(&est, 1); // LAN
+    assert(kad_rtt_est_timeout(&est) == KAD_RPC_RTO_MIN_MILLIS);
+    kad_rtt_est_sample(&est, 1000000);
+    assert(kad_rtt_est_timeout(&est) == KAD_RPC_RTO_MAX_MILLIS);
+
+    // lookups table
+
+    ctx.lookups.max = 2;
+    kad_guid t1 = {{1}, true}, t2 = {{2}, true};
+    struct kad_lookup *l1 = kad_lookups_new(&ctx.lookups, &t1, 0);
+    struct kad_lookup *l2 = kad_lookups_new(&ctx.lookups, &t2, 0);
+    assert(l1 && l2 && l1 != l2 && l1->id != l2->id);
+    assert(!kad_lookups_new(&ctx.lookups, &t1, 0)); // capped
+    assert(kad_lookups_find(&ctx.lookups, &t2) == l2);
+    assert(kad_lookups_get(&ctx.lookups, l1->id) == l1);
+    assert(l1->deadline == KAD_LOOKUP_DEADLINE_MILLIS);
+
+    // Responders are kept sorted by distance to target, k at most.
+    for (int i = KAD_K_CONST + 2; i > 0; --i) {
+        struct kad_node_info info = {.id = {{0, (unsigned char)i}, true}};
+        kad_lookup_responded(l2, &info, i * 10);
+    }
+    kad_lookup_responded(l2, &(struct kad_node_info){.id = {{0, 1}, true}}, 5);
+    assert(l2->result.nodes_len == KAD_K_CONST);
+    for (size_t i = 0; i < KAD_K_CONST; ++i) {
+        assert(l2->result.nodes[i].id.bytes[1] == i + 1);
+        assert(l2->result.rtts[i] == (int)(i + 1) * 10);
+    }
+    assert(l2->result.stats.responses == KAD_K_CONST + 3);
+    assert(l2->result.stats.rtt_min == 5);
+    assert(l2->result.stats.rtt_max == (KAD_K_CONST + 2) * 10);
+
+
+    // Queried nodes: only the k closest are kept, closest first.
+    const int queried = KAD_K_CONST + 2; // coprime with 3
+    for (int i = 0; i < queried; ++i) {
+        struct kad_node_info info = {.id = {{0, (unsigned char)((i * 3) % queried + 1)}, true}};
+        kad_lookup_past_insert(l2, kad_lookup_new_from(l2, &info, t2,
+                                                       ROUTES_RTT_UNKNOWN));
+    }
+    assert(l2->past_len == KAD_K_CONST);
+    for (size_t i = 0; i < KAD_K_CONST; ++i)
+        assert(l2->past[i]->id.bytes[1] == i + 1);
+    assert(l2->nodes.used == KAD_K_CONST);
+
+    // Ids are seen once, up to 3/4 of the set; ids past that are unseen.
+    assert(kad_seen_add(&l1->seen, &t1));
+    assert(!kad_seen_add(&l1->seen, &t1));
+    for (int i = 0; i < KAD_LOOKUP_SEEN_SIZE; ++i)
+        assert(kad_seen_add(&l1->seen, &(kad_guid){{0xff, (unsigned char)i}, true}));
+    assert(l1->seen.len == KAD_LOOKUP_SEEN_SIZE / 4 * 3);
+    assert(!kad_seen_add(&l1->seen, &t1));
+    assert(!kad_seen_add(&l1->seen, &(kad_guid){{0xff, 0}, true}));
+    assert(!kad_seen_add(&l1->seen, &(kad_guid){{0xff, 100}, true}));
+    assert(kad_seen_add(&l1->seen, &(kad_guid){{0xff, KAD_LOOKUP_SEEN_SIZE - 1}, true}));
+
+    unsigned l1_id = l1->id;
+    kad_lookups_end(&ctx.lookups, l1);
+    assert(!kad_lookups_get(&ctx.lookups, l1_id));
+    assert(!kad_lookups_find(&ctx.lookups, &t1));
+    l1 = kad_lookups_new(&ctx.lookups, &t1, 0);
+    assert(l1 && l1->id != l1_id); // ids aren't reused
+    assert(l1->seen.len == 0 && l1->past_len == 0);
+    kad_lookups_end(&ctx.lookups, l1);
+    kad_lookups_end(&ctx.lookups, l2);
+    assert(ctx.lookups.len == 0);
+    ctx.lookups.max = KAD_LOOKUPS_DEFAULT;
+
+    // Parallelism modes
+
+    ctx.lookups.mode = KAD_LOOKUP_PAR_STRICT;
+    l1 = kad_lookups_new(&ctx.lookups, &t1, 0);
+    assert(l1 && l1->mode == KAD_LOOKUP_PAR_STRICT);
+    struct kad_rpc_query dummy = {0};
+    assert(kad_lookup_par_free(l1) == KAD_ALPHA_CONST);
+    l1->sched = 1;
+    assert(kad_lookup_par_add(l1, &dummy));
+    assert(kad_lookup_par_free(l1) == KAD_ALPHA_CONST - 2);
+    assert(!kad_lookup_iterate(l1)); // waits for the whole round
+    l1->sched = 0;
+    assert(!kad_lookup_iterate(l1));
+    assert(kad_lookup_par_remove(l1, &dummy));
+    // Learned node (distance 0x21) not closer than queried (0x11): k next.
+    kad_lookup_past_insert(l1, kad_lookup_new_from(
+                               l1, &(struct kad_node_info){.id = {{0x10}, true}},
+                               t1, ROUTES_RTT_UNKNOWN));
+    assert(node_heap_push(&l1->next, kad_lookup_new_from(
+                              l1, &(struct kad_node_info){.id = {{0x20}, true}},
+                              t1, ROUTES_RTT_UNKNOWN)));
+    assert(kad_lookup_iterate(l1));
+    assert(l1->round == 1 && l1->par_len == KAD_K_CONST);
+    l1->mode = KAD_LOOKUP_PAR_LOOSE;
+    assert(kad_lookup_iterate(l1));
+    assert(l1->round == 2 && l1->par_len == KAD_K_CONST);
+    l1->mode = KAD_LOOKUP_PAR_BOUNDED;
+    assert(kad_lookup_par_add(l1, &dummy));
+    assert(kad_lookup_iterate(l1)); // doesn't wait
+    assert(l1->round == 3 && l1->par_len == KAD_ALPHA_CONST);
+    assert(kad_lookup_par_remove(l1, &dummy));
+    // Closer node (0x10) ranked after a same-class faster one (0x12): α next.
+    l1->mode = KAD_LOOKUP_PAR_STRICT;
+    l1->par_len = KAD_K_CONST;
+    assert(node_heap_push(&l1->next, kad_lookup_new_from(
+                              l1, &(struct kad_node_info){.id = {{0x13}, true}},
+                              t1, 10)));
+    assert(node_heap_push(&l1->next, kad_lookup_new_from(
+                              l1, &(struct kad_node_info){.id = {{0x11}, true}},
+                              t1, 100)));
+    assert(l1->next.buf[0]->id.bytes[0] == 0x13);
+    assert(kad_lookup_iterate(l1));
+    assert(l1->round == 4 && l1->par_len == KAD_ALPHA_CONST);
+
+    // Converged once the k closest nodes seen responded.
+    assert(!kad_lookup_converged(l1));
+    for (int i = 0; i < KAD_K_CONST; ++i)
+        kad_lookup_responded(l1, &(struct kad_node_info){
+                .id = {{0x1, (unsigned char)(2 * i)}, true}}, 10);
+    assert(kad_lookup_converged(l1));
+    assert(node_heap_push(&l1->next, kad_lookup_new_from(
+                              l1, &(struct kad_node_info){.id = {{0x1, 1}, true}},
+                              t1, ROUTES_RTT_UNKNOWN)));
+    assert(!kad_lookup_converged(l1));
+    kad_lookups_end(&ctx.lookups, l1);
+    ctx.lookups.mode = KAD_LOOKUP_PAR_DEFAULT;
+
 
     struct iobuf rsp = {0};
 
@@ -57,6 +230,9 @@ int main ()
 
     // find_node answer
 
+    struct kad_lookup *lookup = kad_lookups_new(&ctx.lookups, &(kad_guid){{3}, true}, 0);
+    assert(lookup);
+
     struct kad_rpc_query *q1 = calloc(1, sizeof(struct kad_rpc_query));
     assert(q1);
     assert(query_init(q1));
@@ -67,23 +243,30 @@ int main ()
             .type=KAD_RPC_TYPE_QUERY,
             .meth=KAD_RPC_METH_FIND_NODE,
             .target={{3}, true},
-        }
+        },
+        .timeout.item=LIST_ITEM_INIT(q1->timeout.item),
+        .lookup_id=lookup->id,
     };
     struct kad_rpc_query *evicted;
     assert(req_lru_put(ctx.reqs_out, q1, &evicted));
-    ctx.lookup.par[0] = q1;
+    lookup->par[0] = q1;
+    struct event ev_timeout = {"timeout", .cb=NULL, .args={{{0}}}, .fatal=false};
+    q1->timeout = (struct timer){
+        .name="timeout", .once=true, .delay=KAD_RPC_QUERY_TIMEOUT_MILLIS,
+        .event=&ev_timeout
+    };
+    assert(timer_init(&timers, &q1->timeout, 0));
+    assert(timers.len == 1);
 
     struct kad_node_info nodes[3] = {
-        {{{0x2}, true}, {0}, {0}},
-        {{{0x4}, true}, {0}, {0}},
-        {{{0x6}, true}, {0}, {0}},
+        {{{0x2}, true}, {0}},
+        {{{0x4}, true}, {0}},
+        {{{0x6}, true}, {0}},
     };
 
-    struct sockaddr_in *sa = (struct sockaddr_in*)&ss;
-    sa->sin_family=AF_INET; sa->sin_port=htons(0x0016);
-    sa->sin_addr.s_addr=htonl(0x01010101); nodes[0].addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010200); nodes[1].addr = ss;
-    sa->sin_addr.s_addr=htonl(0x01010201); nodes[2].addr = ss;
+    nodes[0].addr = (struct compact_addr){COMPACT_ADDR4_LEN, {1, 1, 1, 1, 0, 0x16}};
+    nodes[1].addr = (struct compact_addr){COMPACT_ADDR4_LEN, {1, 1, 2, 0, 0, 0x16}};
+    nodes[2].addr = (struct compact_addr){COMPACT_ADDR4_LEN, {1, 1, 2, 1, 0, 0x16}};
 
     struct kad_rpc_msg r1 = {
         .tx_id={"x1", true},
@@ -96,12 +279,128 @@ int main ()
     assert(kad_rpc_handle_response(&ctx, &r1));
 
     assert(list_count(&ctx.reqs_out->litems) == 0);
+    assert(timers.len == 1); // query timeout cancelled, kad-lookup-next set
     size_t route_count = 0;
     for (size_t i = 0; i < KAD_GUID_SPACE_IN_BITS; i++)
-        route_count += list_count(&ctx.routes->buckets[i]);
+        if (ctx.routes->buckets[i])
+            route_count += ctx.routes->buckets[i]->len;
     assert(route_count == 4);
-    assert(ctx.lookup.next.len == 3);
-    assert(ctx.lookup.round == 1);
+    assert(lookup->next.len == 3);
+    assert(lookup->round == 1);
+    assert(routes_rtt(ctx.routes, &nodes[0].id) == ROUTES_RTT_UNKNOWN);
+    assert(lookup->result.nodes_len == 1);
+    assert(kad_guid_eq(&lookup->result.nodes[0].id, &r1.node_id));
+    assert(lookup->result.stats.responses == 1);
+    assert(ctx.rtt.samples == 1);
+
+    // Nodes already seen aren't queued again, nodes already known are.
+    struct kad_node_info known[2] = {
+        {{{0x8}, true}, {COMPACT_ADDR4_LEN, {1, 1, 3, 0, 0, 0x16}}},
+        {{{0xa}, true}, {COMPACT_ADDR4_LEN, {1, 1, 3, 1, 0, 0x16}}},
+    };
+    assert(routes_insert(ctx.routes, &known[0], 0));
+    assert(routes_insert(ctx.routes, &known[1], 0));
+    struct kad_rpc_query *q3 = calloc(1, sizeof(struct kad_rpc_query));
+    assert(q3);
+    *q3 = (struct kad_rpc_query){
+        .msg = {
+            .tx_id={"x3", true},
+            .node_id={{0x1}, true},
+            .type=KAD_RPC_TYPE_QUERY,
+            .meth=KAD_RPC_METH_FIND_NODE,
+            .target={{3}, true},
+        },
+        .timeout.item=LIST_ITEM_INIT(q3->timeout.item),
+        .lookup_id=lookup->id,
+    };
+    assert(req_lru_put(ctx.reqs_out, q3, &evicted));
+    assert(kad_lookup_par_add(lookup, q3));
+    r1.tx_id = (kad_rpc_msg_tx_id){"x3", true};
+    r1.nodes[3] = known[0];
+    r1.nodes[4] = known[1];
+    r1.nodes_len = 5;
+    assert(kad_rpc_handle_response(&ctx, &r1));
+    assert(lookup->next.len == 5);
+    assert(lookup->round == 2);
+    assert(lookup->result.nodes_len == 1);
+
+    // Completion hands the result to the callback.
+    int done = 0;
+    lookup->cb = lookup_done;
+    lookup->cb_data = &done;
+    lookup->deadline = 0;
+    unsigned lookup_id = lookup->id;
+    assert(kad_lookup_next(lookup_id, &ctx));
+    assert(done == 1);
+    assert(!kad_lookups_get(&ctx.lookups, lookup_id));
+    assert(kad_guid_eq(&lookup_result.target, &(kad_guid){{3}, true}));
+    assert(lookup_result.nodes_len == 1);
+    assert(kad_guid_eq(&lookup_result.nodes[0].id, &r1.node_id));
+    assert(lookup_result.stats.rounds == 2);
+    assert(lookup_result.stats.responses == 2);
+    assert(lookup_result.stats.rtt_min <= lookup_result.stats.rtt_mean);
+    assert(lookup_result.stats.rtt_mean <= lookup_result.stats.rtt_max);
+
+    // Responses to a finished lookup are ignored.
+    struct kad_rpc_query *q2 = calloc(1, sizeof(struct kad_rpc_query));
+    assert(q2);
+    *q2 = (struct kad_rpc_query){
+        .msg = {
+            .tx_id={"x2", true},
+            .node_id={{0x1}, true},
+            .type=KAD_RPC_TYPE_QUERY,
+            .meth=KAD_RPC_METH_FIND_NODE,
+            .target={{3}, true},
+        },
+        .timeout.item=LIST_ITEM_INIT(q2->timeout.item),
+        .lookup_id=lookup_id,
+    };
+    assert(req_lru_put(ctx.reqs_out, q2, &evicted));
+    r1.tx_id = (kad_rpc_msg_tx_id){"x2", true};
+    size_t timers_len = timers.len;
+    assert(kad_rpc_handle_response(&ctx, &r1));
+    assert(list_count(&ctx.reqs_out->litems) == 0);
+    assert(timers.len == timers_len); // no kad-lookup-next
+
+    // Responses after their round timed out feed the RTT estimate and the
+    // lookup.
+    lookup = kad_lookups_new(&ctx.lookups, &(kad_guid){{3}, true}, tick_millis());
+    assert(lookup);
+    struct kad_rpc_query *q4 = calloc(1, sizeof(struct kad_rpc_query));
+    assert(q4);
+    *q4 = (struct kad_rpc_query){
+        .msg = {
+            .tx_id={"x4", true},
+            .node_id={{0x1}, true},
+            .type=KAD_RPC_TYPE_QUERY,
+            .meth=KAD_RPC_METH_FIND_NODE,
+            .target={{3}, true},
+        },
+        .timeout.item=LIST_ITEM_INIT(q4->timeout.item),
+        .lookup_id=lookup->id,
+        .created=tick_millis(),
+    };
+    assert(req_lru_put(ctx.reqs_out, q4, &evicted));
+    assert(kad_lookup_par_add(lookup, q4));
+    assert(kad_seen_add(&lookup->seen, &known[0].id));
+    assert(node_heap_push(&lookup->next, kad_lookup_new_from(
+                              lookup, &known[0], lookup->target,
+                              ROUTES_RTT_UNKNOWN)));
+    int round = lookup->round;
+    assert(kad_lookup_timeout(lookup->id, round, &ctx));
+    assert(kad_lookup_par_is_empty(lookup) && lookup->round == round + 1);
+    assert(lookup->sched == 1 && lookup->next.len == 0); // known[0] next
+    assert(list_count(&ctx.reqs_out->litems) == 1);
+    unsigned long long samples = ctx.rtt.samples;
+    r1.tx_id = (kad_rpc_msg_tx_id){"x4", true};
+    assert(kad_rpc_handle_response(&ctx, &r1));
+    assert(list_count(&ctx.reqs_out->litems) == 0);
+    assert(ctx.rtt.samples == samples + 1);
+    assert(lookup->result.nodes_len == 1 && lookup->result.stats.responses == 1);
+    assert(lookup->next.len == 4); // known[0] already seen
+    assert(lookup->round == round + 1); // round left to run
+    assert(lookup->sched == 1);
+    kad_lookups_end(&ctx.lookups, lookup);
 
 
     kad_rpc_terminate(&ctx, NULL);
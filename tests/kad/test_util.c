@@ -15,18 +15,19 @@ void kad_node_info_set(struct kad_node_info *dst,
         sa->sin_family = src->addr4.sin_family;
         sa->sin_addr.s_addr = htonl(src->addr4.sin_addr.s_addr);
         sa->sin_port = htons(src->addr4.sin_port);
-        *dst = (struct kad_node_info){.id = src->id, .addr = ss, .addr_str = {0}};
     }
     else if (src->addr4.sin_family == AF_INET6) {
         struct sockaddr_in6 *sa6 = (struct sockaddr_in6*)&ss;
         sa6->sin6_family = src->addr6.sin6_family;
         memcpy(sa6->sin6_addr.s6_addr, src->addr6.sin6_addr.s6_addr, sizeof(struct in6_addr));
         sa6->sin6_port = htons(src->addr6.sin6_port);
-        *dst = (struct kad_node_info){.id = src->id, .addr = ss, .addr_str = {0}};
     }
     else {
         // TODO
+        return;
     }
+    *dst = (struct kad_node_info){.id = src->id};
+    compact_addr_from_sockaddr(&dst->addr, &ss);
 }
 
 bool kad_node_info_equals(const struct kad_node_info *got,
@@ -37,12 +38,13 @@ bool kad_node_info_equals(const struct kad_node_info *got,
 
     return
         kad_guid_eq(&got->id, &info.id) &&
-        sockaddr_storage_eq(&got->addr, &info.addr);
+        compact_addr_eq(&got->addr, &info.addr);
 }
 
 bool query_init(struct kad_rpc_query *q) {
     list_init(&q->litem);
     list_init(&q->hitem);
+    list_init(&q->timeout.item);
     kad_rpc_generate_tx_id(&q->msg.tx_id);
     return (q->created = now_millis()) != -1;
 }
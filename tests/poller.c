@@ -0,0 +1,81 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <unistd.h>
+#include "log.h"
+#include "poller.h"
+
+static void test_backend(enum poller_backend backend)
+{
+    struct poller p = {0};
+    assert(poller_init(&p, backend, 2));
+
+    int fds1[2], fds2[2];
+    assert(pipe(fds1) == 0);
+    assert(pipe(fds2) == 0);
+    int data1 = 1, data2 = 2;
+    assert(poller_add(&p, fds1[0], POLLER_IN, &data1));
+    assert(poller_add(&p, fds2[0], POLLER_IN, &data2));
+    assert(p.len == 2);
+    assert(!poller_add(&p, fds1[1], POLLER_IN, NULL)); // full
+    assert(poller_data(&p, fds1[0]) == &data1);
+    assert(poller_data(&p, fds1[1]) == NULL);
+    assert(poller_data(&p, -1) == NULL);
+    assert(poller_data(&p, 1 << 20) == NULL);
+
+    struct poller_event evs[2] = {0};
+    assert(poller_wait(&p, evs, 0) == 0);
+
+    assert(write(fds2[1], "x", 1) == 1);
+    assert(poller_wait(&p, evs, 100) == 1);
+    assert(evs[0].fd == fds2[0]);
+    assert(evs[0].events & POLLER_IN);
+    assert(evs[0].data == &data2);
+
+    assert(poller_mod(&p, fds2[0], 0));
+    assert(poller_wait(&p, evs, 0) == 0);
+    assert(poller_mod(&p, fds2[0], POLLER_IN));
+    assert(poller_wait(&p, evs, 0) == 1);
+
+    // Pipe write end is writable
+    assert(poller_mod(&p, fds2[0], 0));
+    assert(poller_del(&p, fds1[0]));
+    assert(poller_data(&p, fds1[0]) == NULL);
+    assert(poller_add(&p, fds1[1], POLLER_OUT, NULL));
+    assert(poller_wait(&p, evs, 0) == 1);
+    assert(evs[0].fd == fds1[1]);
+    assert(evs[0].events & POLLER_OUT);
+    assert(evs[0].data == NULL);
+    assert(poller_del(&p, fds1[1]));
+    assert(poller_add(&p, fds1[0], POLLER_IN, &data1));
+    assert(poller_mod(&p, fds2[0], POLLER_IN));
+
+    assert(poller_del(&p, fds2[0]));
+    assert(p.len == 1);
+    assert(poller_wait(&p, evs, 0) == 0);
+
+    assert(write(fds1[1], "x", 1) == 1);
+    assert(poller_wait(&p, evs, 100) == 1);
+    assert(evs[0].fd == fds1[0]);
+    assert(evs[0].data == &data1);
+
+    poller_terminate(&p);
+    for (int i = 0; i < 2; ++i) {
+        close(fds1[i]);
+        close(fds2[i]);
+    }
+}
+
+int main()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    assert(!poller_backend_available(POLLER_BACKEND_NONE));
+    assert(poller_backend_available(POLLER_BACKEND_POLL));
+    test_backend(POLLER_BACKEND_POLL);
+    if (poller_backend_available(POLLER_BACKEND_EPOLL))
+        test_backend(POLLER_BACKEND_EPOLL);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
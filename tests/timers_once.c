@@ -16,7 +16,8 @@ int main ()
 
     event_queue evq = {0};
 
-    struct list_item timer_list = LIST_ITEM_INIT(timer_list);
+    struct timers timer_list;
+    assert(timers_init(&timer_list));
 
     struct timer *t1 = malloc(sizeof(struct timer));
     assert(t1);
@@ -31,13 +32,15 @@ int main ()
 
     assert(event_queue_status(&evq) == QUEUE_STATE_EMPTY);
     for (int i=0; i<4; ++i) {
+        assert(tick_update() >= 0);
         int timeout = timers_get_soonest(&timer_list);
         assert(timeout >= -1);
         assert(msleep(100) == 0); // say poll(.., timeout) got trigged by fd events
+        assert(tick_update() >= 0);
         assert(timers_apply(&timer_list, &evq));
     }
     assert(event_queue_status(&evq) != QUEUE_STATE_EMPTY);
-    assert(list_is_empty(&timer_list));
+    assert(timer_list.len == 0);
     /* assert(t1 == NULL); */
 
 
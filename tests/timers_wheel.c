@@ -0,0 +1,222 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include <stdlib.h>
+#include "log.h"
+#include "utils/time.h"
+#include "timers.c"
+
+/* Time is driven by the test through timers_advance(), so that expiries
+   are checked to the ms without sleeping. */
+
+#define RANDOM_LEN 10000
+
+static struct event *evs[RANDOM_LEN];
+static struct timer tms[RANDOM_LEN];
+static long long fired_at[RANDOM_LEN];
+
+static size_t drain(event_queue *evq, long long tack)
+{
+    size_t n = 0;
+    struct event *ev;
+    while ((ev = event_queue_get(evq))) {
+        fired_at[ev->args.kad_lookup.round] = tack;
+        n++;
+    }
+    return n;
+}
+
+static void timer_set(struct timers *w, size_t i, long long delay, bool once)
+{
+    // Index carried by some int arg.
+    *evs[i] = (struct event){"ev", .cb=NULL, .args.kad_lookup={.round=i},
+                             .fatal=false};
+    tms[i] = (struct timer){.name="t", .delay=delay, .once=once, .event=evs[i]};
+    fired_at[i] = -1;
+    assert(timer_init(w, &tms[i], w->now));
+}
+
+static void test_levels(void)
+{
+    event_queue evq = {0};
+    struct timers w;
+    assert(timers_init(&w));
+    w.now = 1000;
+
+    const long long delays[] = {
+        0, 1, 63, 64, 65, 4095, 4096, 4097, 300000, 1LL << 30, 1LL << 37,
+    };
+    const size_t len = sizeof(delays) / sizeof(delays[0]);
+    for (size_t i = 0; i < len; ++i)
+        timer_set(&w, i, delays[i], true);
+    assert(w.len == len);
+    assert(!list_is_empty(&w.overflow));
+    assert(timers_next_expire(&w) == 1000);
+
+    for (size_t i = 0; i < len; ++i) {
+        long long expire = 1000 + delays[i];
+        if (expire > w.now) {
+            assert(timers_advance(&w, &evq, expire - 1));
+            assert(drain(&evq, expire - 1) == 0);
+            assert(timers_next_expire(&w) == expire);
+        }
+        assert(timers_advance(&w, &evq, expire));
+        assert(drain(&evq, expire) == 1);
+        assert(fired_at[i] == expire);
+    }
+    assert(w.len == 0);
+    assert(timers_next_expire(&w) == -1);
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l)
+        assert(w.occupied[l] == 0);
+}
+
+static void test_periodic_and_cancel(void)
+{
+    event_queue evq = {0};
+    struct timers w;
+    assert(timers_init(&w));
+    long long base = 1 << 18; // timer_init() takes 0 as current time
+    w.now = base;
+
+    timer_set(&w, 0, 100, false);
+    timer_set(&w, 1, 5000, true);
+    timer_set(&w, 2, 70, true);
+    assert(tms[1].level == 2 && w.occupied[2] != 0);
+
+    assert(timer_cancel(&w, &tms[1]));
+    assert(w.len == 2);
+    assert(!timer_is_pending(&tms[1]));
+    assert(!timer_cancel(&w, &tms[1]));
+
+    // periodic fired once (missed twice), once timer once.
+    assert(timers_advance(&w, &evq, base + 350));
+    assert(drain(&evq, base + 350) == 2);
+    assert(tms[0].missed == 2 && w.missed == 2);
+    assert(w.len == 1);
+    assert(!timer_is_pending(&tms[2]));
+    assert(timer_is_pending(&tms[0]));
+    assert(tms[0].expire == base + 400);
+    assert(timers_next_expire(&w) == base + 400);
+
+    // A stall of 96 periods: fired once more.
+    assert(timers_advance(&w, &evq, base + 10000));
+    assert(drain(&evq, base + 10000) == 1);
+    assert(fired_at[1] == -1);
+    assert(w.missed == 98);
+    assert(tms[0].expire == base + 10100);
+
+    assert(timer_cancel(&w, &tms[0]));
+    assert(w.len == 0);
+    for (int l = 0; l < TIMERS_WHEEL_LEVELS; ++l)
+        assert(w.occupied[l] == 0);
+}
+
+static void test_catch_up(void)
+{
+    event_queue evq = {0};
+    struct timers w;
+    assert(timers_init(&w));
+    assert(w.catch_up_max == TIMERS_CATCH_UP_MAX);
+    w.catch_up_max = 3;
+    long long base = 1 << 18;
+    w.now = base;
+
+    timer_set(&w, 0, 10, false);
+    tms[0].catch_up = true;
+
+    // 2 periods late: all caught up.
+    assert(timers_advance(&w, &evq, base + 30));
+    assert(drain(&evq, base + 30) == 3);
+    assert(tms[0].missed == 0);
+    assert(tms[0].expire == base + 40);
+
+    // 10 periods late: bounded.
+    assert(timers_advance(&w, &evq, base + 135));
+    assert(drain(&evq, base + 135) == 3);
+    assert(tms[0].missed == 7 && w.missed == 7);
+    assert(tms[0].expire == base + 140);
+
+    // More than the event queue's ring holds.
+    w.catch_up_max = 1000;
+    assert(timers_advance(&w, &evq, base + 140 + 10 * 300));
+    assert(evq.spilled > 0);
+    assert(drain(&evq, base + 3140) == 301);
+    assert(tms[0].expire == base + 3150);
+    event_queue_reset(&evq);
+
+    assert(timer_cancel(&w, &tms[0]));
+
+    struct timer t = {.name="t", .delay=0, .once=false, .event=evs[0]};
+    assert(!timer_init(&w, &t, w.now));
+    assert(w.len == 0);
+}
+
+/* A timer armed right after being applied, within the same ms, expires on
+   the next one, which timers_get_soonest() should wait for. */
+static void test_same_ms(void)
+{
+    event_queue evq = {0};
+    struct timers w;
+    long long base = 1 << 18;
+    tick_set(base);
+    assert(timers_init(&w));
+
+    timer_set(&w, 0, 0, true);
+    assert(timers_get_soonest(&w) == 0);
+    assert(timers_advance(&w, &evq, base));
+    assert(drain(&evq, base) == 1);
+
+    timer_set(&w, 1, 0, true);
+    assert(timers_get_soonest(&w) == 1);
+    assert(timers_advance(&w, &evq, base));
+    assert(drain(&evq, base) == 0);
+    assert(timers_advance(&w, &evq, base + 1));
+    assert(drain(&evq, base + 1) == 1);
+    assert(w.len == 0);
+}
+
+static void test_random(void)
+{
+    event_queue evq = {0};
+    struct timers w;
+    assert(timers_init(&w));
+    long long start = w.now;
+
+    srand(42);
+    for (size_t i = 0; i < RANDOM_LEN; ++i)
+        timer_set(&w, i, rand() % 100000, true);
+
+    long long prev = w.now - 1;
+    while (w.len > 0) {
+        long long tack = prev + 1 + rand() % 500;
+        assert(timers_advance(&w, &evq, tack));
+        drain(&evq, tack);
+        prev = tack;
+    }
+
+    for (size_t i = 0; i < RANDOM_LEN; ++i) {
+        long long expire = start + tms[i].delay;
+        assert(fired_at[i] >= expire);
+        assert(fired_at[i] < expire + 500);
+    }
+}
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    for (size_t i = 0; i < RANDOM_LEN; ++i)
+        assert((evs[i] = malloc(sizeof(struct event))));
+
+    test_levels();
+    test_periodic_and_cancel();
+    test_catch_up();
+    test_same_ms();
+    test_random();
+
+    for (size_t i = 0; i < RANDOM_LEN; ++i)
+        free(evs[i]);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
@@ -46,6 +46,15 @@ static void test_basic_operations(void)
     assert(a.buf[2] == 2);
     assert(a.buf[3] == 3);
 
+    // clear keeps allocation
+    int *buf = a.buf;
+    int_lst_clear(&a);
+    assert(a.len == 0);
+    assert(a.cap == 8);
+    assert(a.buf == buf);
+    assert(int_lst_append(&a, &item, 1));
+    assert(a.buf[0] == 42);
+
     // cleanup
     int_lst_reset(&a);
     assert(a.len == 0);
@@ -0,0 +1,59 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include "log.h"
+#include "utils/pool.h"
+
+struct obj {
+    int  val;
+    char name[8];
+};
+
+#define POOL_LEN 4
+POOL_GENERATE(obj_pool, struct obj, POOL_LEN)
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    struct obj_pool pool;
+    obj_pool_init(&pool);
+    assert(pool.free_len == POOL_LEN);
+
+    struct obj *objs[POOL_LEN + 2];
+    for (int i = 0; i < POOL_LEN; ++i) {
+        objs[i] = obj_pool_get(&pool);
+        assert(obj_pool_owns(&pool, objs[i]));
+        objs[i]->val = i;
+    }
+    assert(pool.used == POOL_LEN && pool.used_max == POOL_LEN);
+    assert(pool.fallbacks == 0);
+    for (int i = 0; i < POOL_LEN; ++i)
+        for (int j = i + 1; j < POOL_LEN; ++j)
+            assert(objs[i] != objs[j]);
+
+    // Exhausted: malloc'd.
+    objs[POOL_LEN] = obj_pool_get(&pool);
+    objs[POOL_LEN + 1] = obj_pool_get(&pool);
+    assert(objs[POOL_LEN] && objs[POOL_LEN + 1]);
+    assert(!obj_pool_owns(&pool, objs[POOL_LEN]));
+    assert(pool.fallbacks == 2);
+    assert(pool.used_max == POOL_LEN);
+
+    for (int i = POOL_LEN + 1; i >= 0; --i)
+        obj_pool_put(&pool, objs[i]);
+    assert(pool.used == 0 && pool.free_len == POOL_LEN);
+    assert(pool.used_max == POOL_LEN);
+
+    // LIFO: last given back, first taken.
+    assert(obj_pool_get(&pool) == objs[0]);
+    obj_pool_put(&pool, objs[0]);
+
+    // No pool: plain malloc.
+    struct obj *o = obj_pool_get(NULL);
+    assert(o && !obj_pool_owns(NULL, o));
+    obj_pool_put(NULL, o);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
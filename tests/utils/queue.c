@@ -1,9 +1,56 @@
 /* Copyright (c) 2019 Foudil Brétel.  All rights reserved. */
 #include <assert.h>
+#include "log.h"
 #include "utils/queue.h"
 
 #define QUEUE4_BIT_LEN 2
 QUEUE_GENERATE(queue4, int, QUEUE4_BIT_LEN)
+QUEUE_SPILL_GENERATE(squeue4, int, QUEUE4_BIT_LEN, 8)
+
+static void test_spill(void)
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    int elt[12] = {0};
+    for (int i = 0; i < 12; ++i)
+        elt[i] = i;
+    squeue4 q = {0};
+    assert(squeue4_status(&q) == QUEUE_STATE_EMPTY);
+    assert(!squeue4_get(&q));
+
+    for (int i = 0; i < 6; ++i)
+        assert(squeue4_put(&q, &elt[i]));
+    assert(q.len == 6 && q.spill.len == 2 && q.spilled == 2);
+    assert(squeue4_status(&q) == QUEUE_STATE_OK);
+
+    // Ring room doesn't bypass the spill.
+    assert(*squeue4_get(&q) == 0);
+    assert(squeue4_put(&q, &elt[6]));
+    assert(q.spill.len == 3);
+    for (int i = 1; i < 7; ++i)
+        assert(*squeue4_get(&q) == i);
+    assert(squeue4_status(&q) == QUEUE_STATE_EMPTY);
+    assert(q.spill.len == 0 && q.spill_head == 0);
+    assert(q.len_max == 6);
+
+    // Back to the ring.
+    assert(squeue4_put(&q, &elt[7]));
+    assert(q.spill.len == 0);
+    assert(*squeue4_get(&q) == 7);
+
+    // Spill limit.
+    for (int i = 0; i < 12; ++i)
+        assert(squeue4_put(&q, &elt[i]));
+    assert(squeue4_status(&q) == QUEUE_STATE_FULL);
+    assert(!squeue4_put(&q, &elt[0]));
+    for (int i = 0; i < 12; ++i)
+        assert(*squeue4_get(&q) == i);
+
+    squeue4_reset(&q);
+    assert(squeue4_status(&q) == QUEUE_STATE_EMPTY);
+    assert(!q.spill.buf);
+    log_shutdown(LOG_TYPE_STDOUT);
+}
 
 int main()    {
     int elt[QUEUE_BIT_LEN(2)] = {1,2,3,4};
@@ -35,4 +82,6 @@ int main()    {
 
     queue4_init(&q1);
     assert(queue4_status(&q1) == QUEUE_STATE_EMPTY);
+
+    test_spill();
 }
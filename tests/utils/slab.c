@@ -0,0 +1,67 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include "log.h"
+#include "utils/slab.h"
+
+struct obj {
+    int  val;
+    char name[8];
+};
+
+#define SLAB_LEN 4
+SLAB_GENERATE(obj_slab, struct obj, SLAB_LEN)
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    struct obj_slab slab;
+    obj_slab_init(&slab);
+    assert(slab.slabs_len == 0 && !slab.free);
+
+    // Grows by whole slabs.
+    struct obj *objs[SLAB_LEN * 2 + 1];
+    for (int i = 0; i < SLAB_LEN * 2 + 1; ++i) {
+        objs[i] = obj_slab_get(&slab);
+        assert(objs[i]);
+        objs[i]->val = i;
+    }
+    assert(slab.slabs_len == 3);
+    assert(slab.used == SLAB_LEN * 2 + 1 && slab.used_max == slab.used);
+    for (int i = 0; i < SLAB_LEN * 2 + 1; ++i) {
+        assert(objs[i]->val == i);
+        for (int j = i + 1; j < SLAB_LEN * 2 + 1; ++j)
+            assert(objs[i] != objs[j]);
+    }
+
+    // LIFO: last given back, first taken.
+    obj_slab_put(&slab, objs[3]);
+    obj_slab_put(&slab, objs[5]);
+    assert(slab.used == SLAB_LEN * 2 - 1);
+    assert(obj_slab_get(&slab) == objs[5]);
+    assert(obj_slab_get(&slab) == objs[3]);
+    assert(slab.slabs_len == 3);
+    obj_slab_put(&slab, NULL);
+    assert(slab.used == SLAB_LEN * 2 + 1);
+
+    // Clear keeps slabs: no growth until they are all used again.
+    obj_slab_clear(&slab);
+    assert(slab.used == 0 && slab.used_max == SLAB_LEN * 2 + 1);
+    for (int i = 0; i < SLAB_LEN * 3; ++i)
+        assert(obj_slab_get(&slab));
+    assert(slab.slabs_len == 3);
+    assert(obj_slab_get(&slab));
+    assert(slab.slabs_len == 4);
+
+    obj_slab_release(&slab);
+    assert(slab.slabs_len == 0 && slab.used == 0 && !slab.free);
+
+    // Reusable after release.
+    assert(obj_slab_get(&slab));
+    assert(slab.slabs_len == 1);
+    obj_slab_release(&slab);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* Copyright (c) 2026 Foudil Brétel.  All rights reserved. */
+#include <assert.h>
+#include "log.h"
+#include "kad/test_util.h"
+#include "utils/time.h"
+
+int main ()
+{
+    assert(log_init(LOG_TYPE_STDOUT, LOG_UPTO(LOG_CRIT)));
+
+    // Updated on first use.
+    long long tick = tick_millis();
+    assert(tick >= 0);
+
+    // Frozen until updated.
+    assert(msleep(20) == 0);
+    assert(tick_millis() == tick);
+    time_t sec = 0;
+    assert(tick_sec(&sec));
+    assert(sec == tick / 1000);
+
+    long long fresh = now_millis();
+    assert(fresh >= tick + 20);
+    assert(tick_millis() == tick);
+
+    long long tack = tick_update();
+    assert(tack >= fresh);
+    assert(tick_millis() == tack);
+
+    // Virtual time.
+    tick_set(5000);
+    assert(tick_millis() == 5000);
+    assert(tick_sec(&sec) && sec == 5);
+    assert(tick_update() >= tack);
+
+    log_shutdown(LOG_TYPE_STDOUT);
+
+    return 0;
+}